@@ -0,0 +1,357 @@
+/*!
+    \file       net_msg_bench.cpp
+    \brief      Micro benchmark of the network message protocol
+    \details    encode/decode in memory and write/read over a socketpair for several message shapes,
+                it reports msgs/s, bytes/s, syscalls per message and allocations per message.
+                usage: net_msg_bench [scale] [filter]
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#include "types.h"
+#include "net_channel.h"
+#include "net_schema.h"
+#include <sys/syscall.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <new>
+#include <thread>
+
+std::string gv_app_name = "net_msg_bench";
+
+//--------------------------------------------------------------------------------
+// counters, read()/write()/send() and operator new are replaced in this program
+//--------------------------------------------------------------------------------
+namespace {
+    std::atomic<long> gv_syscalls(0);       ///< read(), write() and send() calls
+    std::atomic<long> gv_written(0);        ///< written bytes
+    std::atomic<long> gv_allocs(0);         ///< operator new calls
+}
+
+extern "C" ssize_t write(int fd, const void* data, size_t size)
+{
+    gv_syscalls.fetch_add(1, std::memory_order_relaxed);
+    ssize_t n = syscall(SYS_write, fd, data, size);
+    if (n > 0) gv_written.fetch_add(n, std::memory_order_relaxed);
+    return n;
+}
+
+// the sockets are written with send(MSG_NOSIGNAL)
+extern "C" ssize_t send(int fd, const void* data, size_t size, int flags)
+{
+    gv_syscalls.fetch_add(1, std::memory_order_relaxed);
+    ssize_t n = syscall(SYS_sendto, fd, data, size, flags, nullptr, 0);
+    if (n > 0) gv_written.fetch_add(n, std::memory_order_relaxed);
+    return n;
+}
+
+extern "C" ssize_t read(int fd, void* data, size_t size)
+{
+    gv_syscalls.fetch_add(1, std::memory_order_relaxed);
+    return syscall(SYS_read, fd, data, size);
+}
+
+// not inlined, g++ warns of malloc() and free() seen through operator new and operator delete otherwise
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    gv_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+//--------------------------------------------------------------------------------
+// message shapes
+//--------------------------------------------------------------------------------
+//! numeric heavy struct for net_struct_msg_t
+struct numeric_t {
+    int i0, i1, i2, i3, i4, i5, i6, i7;
+    double d0, d1, d2, d3, d4, d5, d6, d7;
+};
+CORAL_NET_SCHEMA(numeric_t,
+    CORAL_NET_FIELD(numeric_t, i0), CORAL_NET_FIELD(numeric_t, i1), CORAL_NET_FIELD(numeric_t, i2), CORAL_NET_FIELD(numeric_t, i3),
+    CORAL_NET_FIELD(numeric_t, i4), CORAL_NET_FIELD(numeric_t, i5), CORAL_NET_FIELD(numeric_t, i6), CORAL_NET_FIELD(numeric_t, i7),
+    CORAL_NET_FIELD(numeric_t, d0), CORAL_NET_FIELD(numeric_t, d1), CORAL_NET_FIELD(numeric_t, d2), CORAL_NET_FIELD(numeric_t, d3),
+    CORAL_NET_FIELD(numeric_t, d4), CORAL_NET_FIELD(numeric_t, d5), CORAL_NET_FIELD(numeric_t, d6), CORAL_NET_FIELD(numeric_t, d7))
+
+namespace {
+    //! a string of letters which compresses like a text
+    std::string text(size_t size, unsigned seed)
+    {
+        std::string str(size, ' ');
+        for (auto& c : str) {
+            seed = seed * 1103515245 + 12345;
+            c = 'a' + (seed >> 16) % 16;
+        }
+        return str;
+    }
+
+    //! a message shape
+    struct shape_t {
+        const char* name;
+        coral::net_variant_msg_t msg;
+    };
+
+    std::vector<shape_t> make_shapes()
+    {
+        std::vector<shape_t> shapes;
+        shape_t tiny{"tiny", {}};
+        tiny.msg.data_container("code", 1);
+        tiny.msg.data_container("value", 2);
+        shapes.push_back(tiny);
+
+        shape_t numeric{"numeric", {}};
+        for (int i = 0; i < 8; i++) {
+            numeric.msg.data_container("i" + std::to_string(i), i);
+            numeric.msg.data_container("d" + std::to_string(i), i * 0.5);
+        }
+        shapes.push_back(numeric);
+
+        shape_t string{"string", {}};
+        for (int i = 0; i < 8; i++) {
+            string.msg.data_container("s" + std::to_string(i), text(256, i));
+        }
+        shapes.push_back(string);
+
+        shape_t wide{"wide", {}};
+        for (int i = 0; i < 64; i++) {
+            if (i % 2) wide.msg.data_container("field_" + std::to_string(i), i);
+            else       wide.msg.data_container("field_" + std::to_string(i), text(16, i));
+        }
+        shapes.push_back(wide);
+
+        shape_t large{"large", {}};
+        large.msg.data_container("body", text(0x40000, 7));   // 256KB
+        shapes.push_back(large);
+
+        shape_t array{"array", {}};
+        std::vector<double> samples(10000);
+        for (size_t i = 0; i < samples.size(); i++) samples[i] = i * 0.25;
+        array.msg.data_container("samples", samples);
+        shapes.push_back(array);
+
+        for (auto& shape : shapes) shape.msg.cmd = 1;
+        return shapes;
+    }
+
+    //! copy a variant message into a net_msg_t
+    coral::net_msg_t to_net_msg(const coral::net_variant_msg_t& from)
+    {
+        coral::net_msg_t msg;
+        msg.cmd = from.cmd;
+        for (const auto& e : from.data_container()) {
+            switch (e.second.type()) {
+                case coral::NET_MSG_TYPE_INT:          msg.data_container(e.first, e.second.get<int>());                 break;
+                case coral::NET_MSG_TYPE_DOUBLE:       msg.data_container(e.first, e.second.get<double>());              break;
+                case coral::NET_MSG_TYPE_STRING:       msg.data_container(e.first, e.second.get<std::string>());         break;
+                case coral::NET_MSG_TYPE_DOUBLE_ARRAY: msg.data_container(e.first, e.second.get<std::vector<double>>()); break;
+                default: break;
+            }
+        }
+        return msg;
+    }
+
+    //--------------------------------------------------------------------------------
+    // measurement
+    //--------------------------------------------------------------------------------
+    struct result_t {
+        long msgs = 0;
+        long bytes = 0;
+        double seconds = 0;
+        long syscalls = 0;
+        long allocs = 0;
+    };
+
+    std::string gv_filter;
+
+    void report(const char* shape, const char* type, const char* mode, const result_t& r)
+    {
+        double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+        std::printf("%-8s %-8s %-16s %12.0f %10.1f %10.2f %10.2f\n", shape, type, mode
+                  , r.msgs / seconds, r.bytes / seconds / 1e6
+                  , static_cast<double>(r.syscalls) / r.msgs, static_cast<double>(r.allocs) / r.msgs);
+        std::fflush(stdout);
+    }
+
+    //! run body n times and measure it, bytes is the wire size of a message
+    result_t measure(long n, long bytes, const std::function<void()>& body)
+    {
+        result_t r;
+        gv_syscalls = 0;
+        gv_allocs = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < n; i++) body();
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        r.msgs = n;
+        r.bytes = n * bytes;
+        r.syscalls = gv_syscalls;
+        r.allocs = gv_allocs;
+        return r;
+    }
+
+    //! run a writer in this thread and a reader in another thread over a socketpair, the bytes are counted by write()
+    result_t measure_socket(long n, const std::function<void(int)>& writer, const std::function<void(int)>& reader)
+    {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            throw coral::network_error("socketpair() error");
+        }
+        result_t r;
+        gv_syscalls = 0;
+        gv_allocs = 0;
+        gv_written = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::thread reader_thread([&] { for (long i = 0; i < n; i++) reader(sv[1]); });
+        for (long i = 0; i < n; i++) writer(sv[0]);
+        reader_thread.join();
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        r.msgs = n;
+        r.bytes = gv_written;
+        r.syscalls = gv_syscalls;
+        r.allocs = gv_allocs;
+        close(sv[0]);
+        close(sv[1]);
+        return r;
+    }
+
+    bool is_selected(const std::string& name)
+    {
+        return gv_filter.empty() || name.find(gv_filter) != std::string::npos;
+    }
+
+    //! in memory encode and decode of a message type
+    template <class Message>
+    void bench_memory(const char* shape, const char* type, const Message& msg, long n)
+    {
+        coral::net_buffer_t buffer;
+        msg.encode(buffer);
+        long size = buffer.size();
+        if (is_selected(std::string(shape) + ' ' + type + " mem-encode")) {
+            report(shape, type, "mem-encode", measure(n, size, [&] { buffer.clear(); msg.encode(buffer); }));
+        }
+        if (is_selected(std::string(shape) + ' ' + type + " mem-decode")) {
+            Message out;
+            size_t used = 0;
+            report(shape, type, "mem-decode", measure(n, size, [&] { out.decode(buffer.data(), buffer.size(), used); }));
+        }
+    }
+
+    //! write_to_network() and read_from_network() over a socketpair
+    template <class Message>
+    void bench_socket(const char* shape, const char* type, Message& msg, long n)
+    {
+        if (is_selected(std::string(shape) + ' ' + type + " sock-unbuffered")) {
+            Message in;
+            report(shape, type, "sock-unbuffered", measure_socket(n
+                , [&](int fd) { msg.write_to_network(fd); }
+                , [&](int fd) { in.read_from_network(fd); }));
+        }
+        if (is_selected(std::string(shape) + ' ' + type + " sock-buffered")) {
+            Message in;
+            coral::net_buffer_t send_buffer, recv_buffer;
+            report(shape, type, "sock-buffered", measure_socket(n
+                , [&](int fd) { msg.write_to_network(fd, send_buffer); }
+                , [&](int fd) { in.read_from_network(fd, recv_buffer); }));
+        }
+    }
+
+    //! net_channel_t with negotiated features over a socketpair
+    template <class Message>
+    void bench_channel(const char* shape, const char* type, const char* mode, const Message& msg, long n, int features)
+    {
+        if (!is_selected(std::string(shape) + ' ' + type + ' ' + mode)) {
+            return;
+        }
+        coral::net_channel_t client, server;
+        Message in;
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            throw coral::network_error("socketpair() error");
+        }
+        client.attach(sv[0]);
+        server.attach(sv[1]);
+        server.accept_protocol(features);
+        // the hello message is answered before the measurement
+        std::thread hello([&] { client.negotiate(features); });
+        uint32_t request_id = 0;
+        while (server.send_buffer().empty() && server.fill() > 0) {
+            server.decode(in, request_id);
+        }
+        server.flush();
+        hello.join();
+
+        result_t r;
+        gv_syscalls = 0;
+        gv_allocs = 0;
+        gv_written = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::thread reader_thread([&] { for (long i = 0; i < n; i++) server.read_msg(in, request_id); });
+        for (long i = 0; i < n; i++) client.write_msg(msg, i);
+        reader_thread.join();
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        r.msgs = n;
+        r.bytes = gv_written;
+        r.syscalls = gv_syscalls;
+        r.allocs = gv_allocs;
+        close(sv[0]);
+        close(sv[1]);
+        report(shape, type, mode, r);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    double scale = argc > 1 ? std::atof(argv[1]) : 1.0;
+    if (argc > 2) gv_filter = argv[2];
+    if (scale <= 0) scale = 1.0;
+
+    std::printf("# syscalls and allocs are counted on both ends of a socketpair\n");
+    std::printf("%-8s %-8s %-16s %12s %10s %10s %10s\n", "shape", "type", "mode", "msgs/s", "MB/s", "syscalls", "allocs");
+    std::vector<shape_t> shapes = make_shapes();
+    for (auto& shape : shapes) {
+        coral::net_buffer_t buffer;
+        shape.msg.encode(buffer);
+        // about 64MB of messages for each case
+        long n = static_cast<long>(scale * std::min<long>(200000, std::max<long>(200, 0x4000000 / buffer.size())));
+        coral::net_msg_t msg = to_net_msg(shape.msg);
+
+        bench_memory(shape.name, "msg", msg, n);
+        bench_memory(shape.name, "variant", shape.msg, n);
+        if (is_selected(std::string(shape.name) + " view mem-decode")) {
+            coral::net_msg_view_t view;
+            size_t used = 0;
+            report(shape.name, "view", "mem-decode", measure(n, buffer.size(), [&] { view.parse(buffer.data(), buffer.size(), used); }));
+        }
+        if (std::string(shape.name) == "numeric") {
+            coral::net_struct_msg_t<numeric_t> numeric;
+            numeric.cmd = 1;
+            numeric.data = {0, 1, 2, 3, 4, 5, 6, 7, 0.0, 0.5, 1.0, 1.5, 2.0, 2.5, 3.0, 3.5};
+            bench_memory(shape.name, "struct", numeric, n);
+        }
+
+        bench_socket(shape.name, "msg", msg, n);
+        bench_socket(shape.name, "variant", shape.msg, n);
+        if (is_selected(std::string(shape.name) + " view sock-buffered")) {
+            coral::net_msg_view_t view;
+            coral::net_buffer_t send_buffer, recv_buffer;
+            report(shape.name, "view", "sock-buffered", measure_socket(n
+                , [&](int fd) { shape.msg.write_to_network(fd, send_buffer); }
+                , [&](int fd) { view.read_from_network(fd, recv_buffer); }));
+        }
+
+        bench_channel(shape.name, "variant", "frame", shape.msg, n, coral::NET_PROTOCOL_FEATURE_FRAME);
+        bench_channel(shape.name, "variant", "frame+keys", shape.msg, n
+                    , coral::NET_PROTOCOL_FEATURE_FRAME | coral::NET_PROTOCOL_FEATURE_KEY_DICTIONARY);
+        bench_channel(shape.name, "variant", "frame+zlib", shape.msg, n
+                    , coral::NET_PROTOCOL_FEATURE_FRAME | coral::NET_PROTOCOL_FEATURE_COMPRESSION);
+    }
+    return 0;
+}
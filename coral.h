@@ -31,6 +31,7 @@
 #ifdef __GNU_MODERN_CPP_THREAD_SUPPORT__
 // Thread pool
 #include "thread_pool.h"
+#include "timer_wheel.h"
 
 #endif // __GNU_MODERN_CPP_THREAD_SUPPORT__
 
@@ -39,8 +40,16 @@
 #include "ora_dbm.h"
 // network interface
 #include "net_interface.h"
+#include "net_channel.h"
+#include "net_reactor.h"
+#include "net_uring.h"
+#include "net_shm.h"
+#include "net_schema.h"
 #include "net_server.h"
 #include "net_client.h"
+#include "net_client_pool.h"
+#include "net_async_client.h"
+#include "net_client_balancer.h"
 // file trans
 #include "file_trans.h"
 
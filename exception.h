@@ -120,6 +120,13 @@ namespace coral {
             : exception("coral - network exception:" + name) {}
     };
 
+    //!client pool exhausted exception, no server failed
+    class pool_exhausted_error : public network_error {
+    public:
+        pool_exhausted_error(std::string name="")
+            : network_error("client pool exhausted:" + name) {}
+    };
+
     //!thread stream initialize exception
     class thread_error : public exception {
     public:
@@ -0,0 +1,295 @@
+/*!
+    \file       net_async_client.cpp
+    \brief      Pipelined asynchronous network client
+    \details    many requests in flight on a connection, the replies are matched by the request id
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#include "net_async_client.h"
+#include "net_client.h"
+#include "log_manager.h"
+#include <cstring>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+//! global application name
+extern std::string gv_app_name;
+
+coral::net_async_client::net_async_client()
+{
+    CORAL_D_CLASS_MEMBER_FUNC_START;
+    max_in_flight_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_MAX_IN_FLIGHT").c_str(), nullptr, 10);
+    CORAL_D_CLASS_MEMBER_FUNC_END;
+}
+
+coral::net_async_client::~net_async_client()
+{
+    CORAL_D_CLASS_MEMBER_FUNC_START;
+    close();
+    CORAL_D_CLASS_MEMBER_FUNC_END;
+}
+
+int coral::net_async_client::init_socket(const std::string& ip_address, const std::string& port_no)
+{
+    CORAL_D_CLASS_MEMBER_FUNC_START;
+    coral::elapsed_time et;
+    std::string log_message;
+    std::ostringstream method_info;
+    method_info << CORAL_D_METHOD_INFO << "(" << ip_address << ',' << port_no << "):";
+    if (!net_shm_path(ip_address).empty()) {
+        throw network_error("shared memory endpoint isn't supported by the async client");
+    }
+    close();
+    socket_ = net_client::connect_socket(ip_address, port_no);
+    try {
+        // the pipelined requests are written as they come, don't let them wait for the acks of the earlier ones
+        int on = 1;
+        setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        channel_.attach(socket_);
+        int features = net_client::protocol_features();
+        if (features != NET_PROTOCOL_FEATURE_NONE) {
+            int threshold = atoi(coral::config::instance()->get_value("NET_CLIENT_COMPRESSION_THRESHOLD").c_str());
+            if (threshold > 0) {
+                channel_.compression_threshold(threshold);
+            }
+            channel_.negotiate(features);
+        }
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd_ < 0) {
+            throw network_error("eventfd() error");
+        }
+        fcntl(socket_, F_SETFL, fcntl(socket_, F_GETFL) | O_NONBLOCK);
+    }
+    catch (...) {
+        ::close(socket_);
+        socket_ = -1;
+        throw;
+    }
+    is_closed_ = false;
+    io_thread_ = std::thread([this] { io_loop(); });
+
+    coral::print_string(log_message, gv_string_msg_size, "%s:ElapsedTime:%.6lfs", CORAL_D_STRMSG(EN, STR, 000004), et.sec());
+    coral::log_manager::write(gv_app_name, method_info.str() + log_message);
+    CORAL_D_CLASS_MEMBER_FUNC_END;
+    return socket_;
+}
+
+std::future<coral::net_msg_t> coral::net_async_client::send(net_msg_t msg)
+{
+    auto promise = std::make_shared<std::promise<net_msg_t>>();
+    std::future<net_msg_t> reply = promise->get_future();
+    send(std::move(msg), [promise](net_msg_t& msg) {
+        if (msg.cmd == -1) {
+            promise->set_exception(std::make_exception_ptr(network_error("connection closed before the reply")));
+        }
+        else {
+            promise->set_value(std::move(msg));
+        }
+    });
+    return reply;
+}
+
+void coral::net_async_client::send(net_msg_t msg, callback_t callback)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    // a handler on the I/O thread can't wait for the replies which only the I/O thread reads
+    if (max_in_flight_ > 0 && std::this_thread::get_id() != io_thread_.get_id()) {
+        space_.wait(lock, [this] { return is_closed_ || pending_.size() < max_in_flight_; });
+    }
+    if (is_closed_) {
+        throw network_error("async client is closed");
+    }
+    uint32_t request_id = ++last_request_id_;
+    if (request_id == 0) {
+        request_id = ++last_request_id_;
+    }
+    pending_[request_id] = std::move(callback);
+    bool is_idle = queued_.empty();
+    queued_.push_back(request_t{request_id, std::move(msg)});
+    lock.unlock();
+    // the I/O thread takes the whole queue, it is woken only for the first request
+    if (is_idle) {
+        wake();
+    }
+}
+
+void coral::net_async_client::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_closed_ = true;
+    }
+    // a callback can't join its own thread, the I/O thread ends by itself and is joined later
+    if (std::this_thread::get_id() == io_thread_.get_id()) {
+        wake();
+        return;
+    }
+    if (io_thread_.joinable()) {
+        wake();
+        io_thread_.join();
+    }
+    fail_all();
+    if (wake_fd_ >= 0) {
+        ::close(wake_fd_);
+        wake_fd_ = -1;
+    }
+    if (socket_ >= 0) {
+        ::close(socket_);
+        socket_ = -1;
+    }
+}
+
+bool coral::net_async_client::is_open()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !is_closed_;
+}
+
+size_t coral::net_async_client::in_flight()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+void coral::net_async_client::io_loop()
+{
+    std::ostringstream method_info;
+    method_info << CORAL_D_METHOD_INFO << "(" << socket_ << "):";
+    try {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (is_closed_) {
+                    break;
+                }
+            }
+            encode_queued();
+            if (!channel_.send_buffer().empty() && channel_.drain() < 0) {
+                coral::log_manager::write(gv_app_name, method_info.str() + "write error:" + std::strerror(errno));
+                break;
+            }
+            struct pollfd poll_fds[2];
+            poll_fds[0].fd = socket_;
+            poll_fds[0].events = POLLIN | (channel_.send_buffer().empty() ? 0 : POLLOUT);
+            poll_fds[1].fd = wake_fd_;
+            poll_fds[1].events = POLLIN;
+            if (poll(poll_fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                throw network_error("poll() error");
+            }
+            if (poll_fds[1].revents & POLLIN) {
+                uint64_t count = 0;
+                while (::read(wake_fd_, &count, sizeof(count)) < 0 && errno == EINTR) {}
+            }
+            if (poll_fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = channel_.fill();
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    // the replies already received are still delivered
+                    dispatch_replies();
+                    coral::log_manager::write(gv_app_name, method_info.str() + "connection closed");
+                    break;
+                }
+                dispatch_replies();
+            }
+        }
+    }
+    catch (std::exception& error) {
+        coral::log_manager::write(gv_app_name, method_info.str() + error.what());
+    }
+    fail_all();
+}
+
+void coral::net_async_client::encode_queued()
+{
+    std::vector<request_t> requests;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests.swap(queued_);
+    }
+    for (auto& request : requests) {
+        try {
+            channel_.encode(request.msg, request.request_id);
+        }
+        catch (std::exception&) {
+            // the message never reaches the server, only this request fails
+            callback_t callback = take_callback(request.request_id);
+            net_msg_t reply;
+            if (callback) {
+                callback(reply);
+            }
+            continue;
+        }
+        if (!channel_.is_framed()) {
+            order_.push_back(request.request_id);
+        }
+    }
+}
+
+void coral::net_async_client::dispatch_replies()
+{
+    net_msg_t reply;
+    uint32_t request_id = 0;
+    while (channel_.decode(reply, request_id)) {
+        if (!channel_.is_framed()) {
+            if (order_.empty()) {
+                throw network_error("reply without a request");
+            }
+            request_id = order_.front();
+            order_.pop_front();
+        }
+        callback_t callback = take_callback(request_id);
+        if (callback) {
+            try {
+                callback(reply);
+            }
+            catch (std::exception& error) {
+                coral::log_manager::write(gv_app_name, std::string("reply handler error:") + error.what());
+            }
+        }
+        reply.clear();
+    }
+}
+
+coral::net_async_client::callback_t coral::net_async_client::take_callback(uint32_t request_id)
+{
+    callback_t callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = pending_.find(request_id);
+        if (found == pending_.end()) {
+            return callback;
+        }
+        callback = std::move(found->second);
+        pending_.erase(found);
+    }
+    space_.notify_one();
+    return callback;
+}
+
+void coral::net_async_client::fail_all()
+{
+    std::unordered_map<uint32_t, callback_t> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_closed_ = true;
+        pending.swap(pending_);
+        queued_.clear();
+    }
+    order_.clear();
+    space_.notify_all();
+    for (auto& item : pending) {
+        net_msg_t reply;
+        if (item.second) {
+            item.second(reply);
+        }
+    }
+}
+
+void coral::net_async_client::wake()
+{
+    uint64_t count = 1;
+    while (::write(wake_fd_, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
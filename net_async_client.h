@@ -0,0 +1,112 @@
+/*!
+    \file       net_async_client.h
+    \brief      Pipelined asynchronous network client
+    \details    many requests in flight on a connection, the replies are matched by the request id
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#ifndef __CORAL_NETASYNCCLIENT_H__
+#define __CORAL_NETASYNCCLIENT_H__
+
+#include "net_channel.h"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! pipelined client, send() doesn't wait for the reply
+    /*!
+        send() tags a request with a request id and queues it, an I/O thread of the client encodes
+        the queued requests, writes them as one stream and matches each reply to its request by the
+        request id of the frame, so the replies can come in any order. a reply completes a future or
+        calls a callback on the I/O thread. without the frame protocol there is no request id and
+        the replies are matched in the order of the requests, the server has to answer in order.
+        send() waits while max_in_flight() requests are waiting for the replies, except on the I/O
+        thread. a request left when the connection is closed fails, a future gets network_error and
+        a callback gets a reply whose cmd is -1.
+    */
+    class net_async_client {
+    public:
+        //! reply handler, it is called on the I/O thread and must not block, cmd is -1 if the request failed
+        using callback_t = std::function<void(net_msg_t& reply)>;
+
+        //! constructor, load the limits of the config
+        net_async_client();
+        //! destructor, close the connection
+        ~net_async_client();
+        net_async_client(const net_async_client&) = delete;
+        net_async_client& operator=(const net_async_client&) = delete;
+
+        /*! connect, negotiate the protocol and start the I/O thread
+            \param ip_address address or "unix:/path" like net_client::init_socket()
+            \param port_no port
+            \return connected socket
+        */
+        int init_socket(const std::string& ip_address, const std::string& port_no);
+        /*! send a request, it is thread safe
+            \param msg request
+            \return future of the reply
+            \exception network_error the connection is closed
+        */
+        std::future<net_msg_t> send(net_msg_t msg);
+        /*! send a request, it is thread safe
+            \param msg request
+            \param callback reply handler
+            \exception network_error the connection is closed
+        */
+        void send(net_msg_t msg, callback_t callback);
+        /*! stop the I/O thread and close the connection, the requests in flight fail.
+            from a callback it only stops the I/O thread, the destructor or a later close() closes the connection
+        */
+        void close();
+        //! is the connection open?
+        bool is_open();
+        //! the number of the requests waiting for the replies
+        size_t in_flight();
+        //! the maximum requests waiting for the replies, 0 is no limit
+        size_t max_in_flight() const { return max_in_flight_; }
+        //! set the maximum requests in flight before init_socket()
+        void max_in_flight(size_t size) { max_in_flight_ = size; }
+
+    private:
+        //! a request queued for the I/O thread
+        struct request_t {
+            uint32_t request_id;    ///< request id
+            net_msg_t msg;          ///< request
+        };
+
+        //! I/O thread
+        void io_loop();
+        //! encode the queued requests into the send buffer
+        void encode_queued();
+        //! decode the received replies and call their handlers
+        void dispatch_replies();
+        //! take the handler of a request
+        callback_t take_callback(uint32_t request_id);
+        //! close the client and fail the requests in flight
+        void fail_all();
+        //! wake the I/O thread
+        void wake();
+
+        int socket_ = -1;                   ///< connected socket
+        int wake_fd_ = -1;                  ///< eventfd to wake the I/O thread
+        net_channel_t channel_;             ///< message channel, used by the I/O thread only
+        std::thread io_thread_;             ///< I/O thread
+        std::mutex mutex_;                  ///< lock of the requests
+        std::condition_variable space_;     ///< a request is done or the client is closed
+        std::vector<request_t> queued_;     ///< requests to be encoded
+        std::unordered_map<uint32_t, callback_t> pending_;  ///< handlers of the requests in flight by request id
+        std::deque<uint32_t> order_;        ///< request ids in the order they are sent, without the frame protocol
+        uint32_t last_request_id_ = 0;      ///< request id of the last request
+        bool is_closed_ = true;             ///< is the connection closed?
+        size_t max_in_flight_ = 0;          ///< the maximum requests in flight
+    }; // class net_async_client
+} // end coral namespace
+
+#endif // __CORAL_NETASYNCCLIENT_H__
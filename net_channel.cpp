@@ -0,0 +1,254 @@
+/*!
+    \file       net_channel.cpp
+    \brief      Network message channel of a connection
+    \details    message framing and protocol negotiation on a connected socket
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#include "net_channel.h"
+#include <zlib.h>
+
+void coral::net_channel_t::attach(int fd)
+{
+    fd_ = fd;
+    features_ = NET_PROTOCOL_FEATURE_NONE;
+    version_ = 0;
+    accept_features_ = NET_PROTOCOL_FEATURE_NONE;
+    is_hello_allowed_ = false;
+    send_buffer_.clear();
+    recv_buffer_.clear();
+    send_keys_.clear();
+    recv_keys_.clear();
+    zip_buffer_.clear();
+    batch_count_ = 0;
+    batch_buffer_.clear();
+    is_batched_ = false;
+}
+
+int coral::net_channel_t::negotiate(int features)
+{
+    net_variant_msg_t hello;
+    hello.cmd = NET_MSG_CMD_HELLO;
+    hello.data_container("version", static_cast<int>(NET_FRAME_VERSION));
+    hello.data_container("features", features);
+    if (write_msg(hello) < 0) {
+        throw coral::network_error("hello write() error");
+    }
+    if (read_msg(hello) <= 0) {
+        throw coral::network_error("hello read() error");
+    }
+    // an old server which doesn't know the hello message echoes it or answers something else
+    const auto& data = hello.data_container();
+    if (hello.cmd != NET_MSG_CMD_HELLO || data.find("ack") == data.end()) {
+        return features_;
+    }
+    version_ = hello.data_container("version").get<int>();
+    features_ = hello.data_container("features").get<int>() & features;
+    // the key dictionary and the compression work only on frames
+    if (!is_framed()) {
+        features_ = NET_PROTOCOL_FEATURE_NONE;
+    }
+    return features_;
+}
+
+void coral::net_channel_t::use_protocol(int features)
+{
+    features_ = features;
+    version_ = (features & NET_PROTOCOL_FEATURE_FRAME) ? NET_FRAME_VERSION : 0;
+    is_hello_allowed_ = false;
+}
+
+bool coral::net_channel_t::answer_hello()
+{
+    net_msg_view_t view;
+    size_t used = 0;
+    if (!view.parse(recv_buffer_.data(), recv_buffer_.size(), used)) {
+        return false;
+    }
+    is_hello_allowed_ = false;
+    if (view.cmd != NET_MSG_CMD_HELLO) {
+        return false;
+    }
+    int version = view.has("version") ? view.get<int>("version") : 0;
+    int features = view.has("features") ? view.get<int>("features") : NET_PROTOCOL_FEATURE_NONE;
+    recv_buffer_.consume(used);
+    features &= accept_features_;
+    // the key dictionary and the compression work only on frames
+    if (!(features & NET_PROTOCOL_FEATURE_FRAME)) {
+        features = NET_PROTOCOL_FEATURE_NONE;
+    }
+
+    // the answer is in the legacy format, the negotiated protocol is used after it
+    net_variant_msg_t answer;
+    answer.cmd = NET_MSG_CMD_HELLO;
+    answer.data_container("ack", true);
+    answer.data_container("version", std::min<int>(version, NET_FRAME_VERSION));
+    answer.data_container("features", features);
+    answer.encode(send_buffer_);
+    version_ = std::min<int>(version, NET_FRAME_VERSION);
+    features_ = features;
+    return true;
+}
+
+bool coral::net_channel_t::peek_cmd(int& cmd)
+{
+    net_frame_header_t header;
+    if (!is_framed() || !batch_buffer_.empty() || !next_frame(header) || header.length < net_frame_header_t::size + sizeof(int)
+        || (header.flags & NET_FRAME_FLAG_BATCH)) {
+        return false;
+    }
+    std::memcpy(&cmd, recv_buffer_.data() + net_frame_header_t::size, sizeof(int));
+    cmd = ntohl(cmd);
+    return true;
+}
+
+void coral::net_channel_t::skip_frame()
+{
+    net_frame_header_t header;
+    if (!is_framed() || !next_frame(header)) {
+        return;
+    }
+    if (uses_key_dictionary()) {
+        size_t body_size = header.length - net_frame_header_t::size;
+        const char* body = recv_buffer_.data() + net_frame_header_t::size;
+        if (header.flags & NET_FRAME_FLAG_COMPRESSED) {
+            inflate_frame(body, body_size);
+        }
+        // a view doesn't copy the values, only the key definitions are kept
+        net_msg_view_t view;
+        while (body_size > 0) {
+            size_t used = 0;
+            if (!view.parse(body, body_size, used, &recv_keys_)) {
+                throw coral::domain_error("malformed frame.");
+            }
+            body += used;
+            body_size -= used;
+        }
+    }
+    recv_buffer_.consume(header.length);
+}
+
+int coral::net_channel_t::flush()
+{
+    end_batch();
+    ssize_t n = net_write_all(fd_, send_buffer_.data(), send_buffer_.size());
+    send_buffer_.clear();
+    return n;
+}
+
+ssize_t coral::net_channel_t::drain()
+{
+    end_batch();
+    size_t size = 0;
+    while (!send_buffer_.empty()) {
+        ssize_t n = ::send(fd_, send_buffer_.data(), send_buffer_.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) {
+            n = ::write(fd_, send_buffer_.data(), send_buffer_.size());
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        send_buffer_.consume(n);
+        size += n;
+    }
+    return size;
+}
+
+ssize_t coral::net_channel_t::fill()
+{
+    const size_t read_size = 0x10000;   // 64KB
+    while (true) {
+        ssize_t n = ::read(fd_, recv_buffer_.prepare(read_size), read_size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n > 0) {
+            recv_buffer_.commit(n);
+        }
+        return n;
+    }
+}
+
+size_t coral::net_channel_t::begin_frame()
+{
+    size_t offset = send_buffer_.size();
+    send_buffer_.prepare(net_frame_header_t::size);
+    send_buffer_.commit(net_frame_header_t::size);
+    return offset;
+}
+
+void coral::net_channel_t::end_batch()
+{
+    if (batch_count_ == 0) {
+        return;
+    }
+    end_frame(batch_offset_, 0, compress_frame(batch_offset_) | NET_FRAME_FLAG_BATCH);
+    batch_count_ = 0;
+}
+
+void coral::net_channel_t::end_frame(size_t offset, uint32_t request_id, int flags)
+{
+    net_frame_header_t header;
+    header.length = send_buffer_.size() - offset;
+    header.version = version_;
+    header.flags = flags;
+    header.request_id = request_id;
+    header.encode(send_buffer_.data() + offset);
+}
+
+bool coral::net_channel_t::next_frame(net_frame_header_t& header)
+{
+    return header.decode(recv_buffer_.data(), recv_buffer_.size()) && recv_buffer_.size() >= header.length;
+}
+
+int coral::net_channel_t::compress_frame(size_t offset)
+{
+    size_t body_offset = offset + net_frame_header_t::size;
+    size_t body_size = send_buffer_.size() - body_offset;
+    if (!uses_compression() || body_size < compression_threshold_ || body_size > max_inflated_size) {
+        return NET_FRAME_FLAG_NONE;
+    }
+    uLongf zip_size = compressBound(body_size);
+    zip_buffer_.clear();
+    char* zip_data = zip_buffer_.prepare(sizeof(uint32_t) + zip_size);
+    uint32_t size_temp = htonl(body_size);
+    std::memcpy(zip_data, &size_temp, sizeof(uint32_t));
+    int rc = compress2(reinterpret_cast<Bytef*>(zip_data + sizeof(uint32_t)), &zip_size
+                     , reinterpret_cast<const Bytef*>(send_buffer_.data() + body_offset), body_size, Z_BEST_SPEED);
+    // incompressible data goes out as it is
+    if (rc != Z_OK || sizeof(uint32_t) + zip_size >= body_size) {
+        return NET_FRAME_FLAG_NONE;
+    }
+    send_buffer_.truncate(body_offset);
+    send_buffer_.append(zip_data, sizeof(uint32_t) + zip_size);
+    return NET_FRAME_FLAG_COMPRESSED;
+}
+
+void coral::net_channel_t::inflate_frame(const char*& body, size_t& body_size)
+{
+    uint32_t size_temp = 0;
+    if (!uses_compression() || body_size < sizeof(uint32_t)) {
+        throw coral::domain_error("unexpected compressed frame.");
+    }
+    std::memcpy(&size_temp, body, sizeof(uint32_t));
+    uLongf inflated_size = ntohl(size_temp);
+    size_t zip_size = body_size - sizeof(uint32_t);
+    // the original size comes from the peer, it is checked before the inflate buffer is allocated
+    if (inflated_size > std::min<size_t>(max_inflated_size, net_max_msg_size()) || inflated_size > zip_size * max_inflate_ratio) {
+        throw coral::domain_error("too big compressed frame.");
+    }
+    zip_buffer_.clear();
+    char* data = zip_buffer_.prepare(inflated_size);
+    uLongf size = inflated_size;
+    int rc = uncompress(reinterpret_cast<Bytef*>(data), &size
+                      , reinterpret_cast<const Bytef*>(body + sizeof(uint32_t)), zip_size);
+    if (rc != Z_OK || size != inflated_size) {
+        throw coral::domain_error("malformed compressed frame.");
+    }
+    body = data;
+    body_size = size;
+}
@@ -0,0 +1,322 @@
+/*!
+    \file       net_channel.h
+    \brief      Network message channel of a connection
+    \details    message framing and protocol negotiation on a connected socket
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#ifndef __CORAL_NETCHANNEL_H__
+#define __CORAL_NETCHANNEL_H__
+
+#include "types.h"
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! message channel of a connection
+    /*!
+        a channel keeps the send and the receive buffer of a connection and the protocol
+        negotiated with the peer. a client calls negotiate() after connect(), a server calls
+        accept_protocol() and the hello message of the client is answered in decode().
+        without negotiation the channel uses the legacy format (cmd, size, fields).
+        on frames a per connection key dictionary and the zlib compression of big frame bodies
+        can be negotiated too. with the batch feature encode_batched() appends one-way messages
+        to a batch frame which goes out as a whole with the next flush, decode() returns the
+        messages of a received batch one by one and is_batched() tells that there is no reply to it.
+
+        encode() and decode() don't do any I/O so an event driven server can use them
+        with non-blocking sockets, write_msg() and read_msg() are blocking helpers.
+        Message is net_msg_t or net_variant_msg_t.
+    */
+    class net_channel_t {
+    public:
+        //! a frame body smaller than this is sent without compression
+        static constexpr size_t default_compression_threshold = 0x4000;   // 16KB
+        //! limit of the original size of a compressed frame body, net_max_msg_size() if it is lower
+        static constexpr size_t max_inflated_size = 0x10000000;  // 256MB
+        //! the highest ratio of deflate, a compressed body claiming more is refused before the allocation
+        static constexpr size_t max_inflate_ratio = 1032;
+        //! default constructor, not attached
+        net_channel_t() = default;
+        //! constructor attached to a connected socket
+        explicit net_channel_t(int fd) { attach(fd); }
+        //! attach to a connected socket and reset the protocol state
+        void attach(int fd);
+        //! socket
+        int fd() const { return fd_; }
+        //! is the framed protocol in use?
+        bool is_framed() const { return features_ & NET_PROTOCOL_FEATURE_FRAME; }
+        //! is the key dictionary in use?
+        bool uses_key_dictionary() const { return features_ & NET_PROTOCOL_FEATURE_KEY_DICTIONARY; }
+        //! is the compression in use?
+        bool uses_compression() const { return features_ & NET_PROTOCOL_FEATURE_COMPRESSION; }
+        //! negotiated NET_PROTOCOL_FEATURE flags
+        int features() const { return features_; }
+        //! frame body size from which the compression is tried
+        size_t compression_threshold() const { return compression_threshold_; }
+        //! set the frame body size from which the compression is tried
+        void compression_threshold(size_t size) { compression_threshold_ = size; }
+        //! negotiated protocol version
+        int version() const { return version_; }
+        /*! client side protocol negotiation, it is a blocking call
+            \param features requested NET_PROTOCOL_FEATURE flags
+            \return negotiated features, NET_PROTOCOL_FEATURE_NONE if the server doesn't know the hello message
+        */
+        int negotiate(int features);
+        /*! server side, the hello message of the client will be answered with these features
+            \param features NET_PROTOCOL_FEATURE flags which the server supports
+        */
+        void accept_protocol(int features) { accept_features_ = features; is_hello_allowed_ = true; }
+        /*! use a protocol without the hello message, the peers agreed on it another way
+            \param features NET_PROTOCOL_FEATURE flags
+        */
+        void use_protocol(int features);
+        /*! serialize a message at the end of the send buffer
+            \param msg message
+            \param request_id request id of the frame, a reply uses the id of its request
+        */
+        template <class Message>
+        void encode(const Message& msg, uint32_t request_id = 0);
+        /*! deserialize a message from the receive buffer
+            \param msg message
+            \param request_id request id of the frame, 0 in the legacy format
+            \return false if the receive buffer doesn't have a whole message yet
+        */
+        template <class Message>
+        bool decode(Message& msg, uint32_t& request_id);
+        //! is the batch feature in use?
+        bool uses_batch() const { return features_ & NET_PROTOCOL_FEATURE_BATCH; }
+        /*! serialize a one-way message into the open batch frame, a batch frame is opened if none
+            \param msg message
+            \exception domain_error the batch feature isn't negotiated
+        */
+        template <class Message>
+        void encode_batched(const Message& msg);
+        //! close the open batch frame, encode(), flush() and drain() close it too
+        void end_batch();
+        //! the number of the messages in the open batch frame
+        size_t batch_count() const { return batch_count_; }
+        //! bytes of the open batch frame
+        size_t batch_bytes() const { return batch_count_ > 0 ? send_buffer_.size() - batch_offset_ : 0; }
+        //! did the last decoded message come in a batch? it isn't replied
+        bool is_batched() const { return is_batched_; }
+        /*! command code of the next whole frame in the receive buffer without decoding it
+            \param cmd command code
+            \return false if there isn't a whole frame or the protocol isn't framed
+        */
+        bool peek_cmd(int& cmd);
+        /*! drop the next whole frame in the receive buffer, an unknown command can be skipped cheaply.
+            with the key dictionary the keys of the frame are still parsed, the later key ids of the peer refer to them
+            \exception domain_error the frame is malformed
+        */
+        void skip_frame();
+        /*! write the send buffer to the socket, it is a blocking call
+            \return written size, -1 if an error occurred
+        */
+        int flush();
+        /*! write the send buffer to a non-blocking socket as much as the socket takes
+            \return written size, -1 if an error occurred, EAGAIN isn't an error
+        */
+        ssize_t drain();
+        /*! encode and write a message, it is a blocking call
+            \return written size, -1 if an error occurred
+        */
+        template <class Message>
+        int write_msg(const Message& msg, uint32_t request_id = 0);
+        /*! read and decode a message, it is a blocking call, cmd is -1 on EOF or an error
+            \return used size, 0 on EOF, -1 if an error occurred
+        */
+        template <class Message>
+        int read_msg(Message& msg, uint32_t& request_id);
+        //! read and decode a message ignoring the request id
+        template <class Message>
+        int read_msg(Message& msg) { uint32_t request_id = 0; return read_msg(msg, request_id); }
+        /*! read bytes from the socket into the receive buffer
+            \return read size, 0 on EOF, -1 if an error occurred(EAGAIN too)
+        */
+        ssize_t fill();
+        //! send buffer
+        net_buffer_t& send_buffer() { return send_buffer_; }
+        const net_buffer_t& send_buffer() const { return send_buffer_; }
+        //! receive buffer
+        net_buffer_t& recv_buffer() { return recv_buffer_; }
+        const net_buffer_t& recv_buffer() const { return recv_buffer_; }
+
+    private:
+        //! reserve a frame header in the send buffer, return the offset of the header
+        size_t begin_frame();
+        //! write the frame header at offset
+        void end_frame(size_t offset, uint32_t request_id, int flags);
+        /*! compress the frame body at offset if it is big enough and the compression pays
+            \return NET_FRAME_FLAG_COMPRESSED if the body has been compressed
+        */
+        int compress_frame(size_t offset);
+        /*! inflate a compressed frame body into the inflate buffer
+            \param body frame body, the inflated body on return
+            \param body_size size of the frame body, the inflated size on return
+        */
+        void inflate_frame(const char*& body, size_t& body_size);
+        /*! get the next whole frame in the receive buffer
+            \return false if there isn't a whole frame yet
+        */
+        bool next_frame(net_frame_header_t& header);
+        /*! answer the hello message if the first message of the client is a hello message
+            \return true if a hello message was answered
+        */
+        bool answer_hello();
+
+        int fd_ = -1;                       ///< socket
+        int features_ = NET_PROTOCOL_FEATURE_NONE;  ///< negotiated features
+        int version_ = 0;                   ///< negotiated version, 0 is the legacy format
+        int accept_features_ = NET_PROTOCOL_FEATURE_NONE;   ///< features which a server supports
+        bool is_hello_allowed_ = false;     ///< server side, is the next message allowed to be a hello message?
+        net_buffer_t send_buffer_;          ///< send buffer
+        net_buffer_t recv_buffer_;          ///< receive buffer
+        net_key_dictionary_t send_keys_;    ///< keys defined to the peer
+        net_key_dictionary_t recv_keys_;    ///< keys defined by the peer
+        size_t compression_threshold_ = default_compression_threshold;  ///< minimum body size to compress
+        net_buffer_t zip_buffer_;           ///< compressed or inflated frame body
+        size_t batch_offset_ = 0;           ///< offset of the open batch frame in the send buffer
+        size_t batch_count_ = 0;            ///< messages of the open batch frame, 0 if none is open
+        net_buffer_t batch_buffer_;         ///< the messages left of a received batch frame
+        bool is_batched_ = false;           ///< did the last decoded message come in a batch?
+    }; // class net_channel_t
+
+    template <class Message>
+    void net_channel_t::encode(const Message& msg, uint32_t request_id)
+    {
+        // the batched messages go out before this one
+        end_batch();
+        size_t offset = is_framed() ? begin_frame() : send_buffer_.size();
+        net_key_dictionary_t* keys = uses_key_dictionary() ? &send_keys_ : nullptr;
+        size_t key_size = send_keys_.size();
+        try {
+            msg.encode(send_buffer_, keys);
+        }
+        catch (...) {
+            // the peer never sees this message, so forget the keys defined in it
+            send_keys_.truncate(key_size);
+            send_buffer_.truncate(offset);
+            throw;
+        }
+        if (is_framed()) {
+            end_frame(offset, request_id, compress_frame(offset));
+        }
+    }
+
+    template <class Message>
+    bool net_channel_t::decode(Message& msg, uint32_t& request_id)
+    {
+        // the first message of a client might be a hello message
+        while (is_hello_allowed_ && !recv_buffer_.empty()) {
+            if (!answer_hello()) break;
+        }
+        size_t used = 0;
+        net_key_dictionary_t* keys = uses_key_dictionary() ? &recv_keys_ : nullptr;
+        // the rest of a received batch comes before the next frame
+        if (!batch_buffer_.empty()) {
+            if (!msg.decode(batch_buffer_.data(), batch_buffer_.size(), used, keys)) {
+                throw coral::domain_error("malformed batch frame.");
+            }
+            batch_buffer_.consume(used);
+            request_id = 0;
+            is_batched_ = true;
+            return true;
+        }
+        is_batched_ = false;
+        if (recv_buffer_.empty()) {
+            return false;
+        }
+        if (!is_framed()) {
+            if (!msg.decode(recv_buffer_.data(), recv_buffer_.size(), used)) {
+                return false;
+            }
+            request_id = 0;
+        }
+        else {
+            net_frame_header_t header;
+            if (!next_frame(header)) {
+                return false;
+            }
+            size_t body_size = header.length - net_frame_header_t::size;
+            const char* body = recv_buffer_.data() + net_frame_header_t::size;
+            if (header.flags & NET_FRAME_FLAG_COMPRESSED) {
+                inflate_frame(body, body_size);
+            }
+            if (header.flags & NET_FRAME_FLAG_BATCH) {
+                if (!uses_batch()) {
+                    throw coral::domain_error("unexpected batch frame.");
+                }
+                batch_buffer_.append(body, body_size);
+                is_hello_allowed_ = false;
+                recv_buffer_.consume(header.length);
+                return decode(msg, request_id);
+            }
+            if (!msg.decode(body, body_size, used, keys) || used != body_size) {
+                throw coral::domain_error("malformed frame.");
+            }
+            used = header.length;
+            request_id = header.request_id;
+        }
+        is_hello_allowed_ = false;
+        recv_buffer_.consume(used);
+        return true;
+    }
+
+    template <class Message>
+    void net_channel_t::encode_batched(const Message& msg)
+    {
+        if (!uses_batch()) {
+            throw coral::domain_error("batch isn't negotiated.");
+        }
+        if (batch_count_ == 0) {
+            batch_offset_ = begin_frame();
+        }
+        size_t offset = send_buffer_.size();
+        net_key_dictionary_t* keys = uses_key_dictionary() ? &send_keys_ : nullptr;
+        size_t key_size = send_keys_.size();
+        try {
+            msg.encode(send_buffer_, keys);
+        }
+        catch (...) {
+            send_keys_.truncate(key_size);
+            send_buffer_.truncate(batch_count_ == 0 ? batch_offset_ : offset);
+            throw;
+        }
+        batch_count_++;
+    }
+
+    template <class Message>
+    int net_channel_t::write_msg(const Message& msg, uint32_t request_id)
+    {
+        encode(msg, request_id);
+        return flush();
+    }
+
+    template <class Message>
+    int net_channel_t::read_msg(Message& msg, uint32_t& request_id)
+    {
+        while (true) {
+            size_t size = recv_buffer_.size();
+            if (decode(msg, request_id)) {
+                return size - recv_buffer_.size();
+            }
+            // the answer of a hello message
+            if (!send_buffer_.empty() && flush() < 0) {
+                break;
+            }
+            ssize_t n = fill();
+            if (n <= 0) {
+                msg.cmd = -1;
+                msg.clear_data_container();
+                return n;
+            }
+        }
+        msg.cmd = -1;
+        msg.clear_data_container();
+        return -1;
+    }
+} // end coral namespace
+
+#endif // __CORAL_NETCHANNEL_H__
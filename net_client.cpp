@@ -9,6 +9,8 @@
 
 #include "net_client.h"
 #include "log_manager.h"
+#include <netdb.h>
+#include <poll.h>
 
 //! global application name
 extern std::string gv_app_name;
@@ -22,6 +24,14 @@ coral::net_client::net_client() {
 
 coral::net_client::~net_client() {
     CORAL_D_CLASS_MEMBER_FUNC_START;
+    stop_linger();
+    try {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        send_batch();
+    }
+    catch (std::exception& error) {
+        coral::log_manager::write(gv_app_name, std::string("net_client::~net_client():batch is lost:") + error.what());
+    }
     close_socket();
     CORAL_D_CLASS_MEMBER_FUNC_END;
 }
@@ -34,15 +44,44 @@ int coral::net_client::init_socket(const std::string& ip_address, const std::str
     std::ostringstream method_info;
     method_info << CORAL_D_METHOD_INFO << "(" << ip_address << ',' << port_no << "):";
     try {
-        client_socket_ = socket(PF_INET, SOCK_STREAM, 0);
-        memset(&server_address_, 0, sizeof(server_address_));
-        server_address_.sin_family = AF_INET;
-        server_address_.sin_addr.s_addr = inet_addr(ip_address.c_str());
-        server_address_.sin_port = htons(atoi(port_no.c_str()));
-
-        int server_address_size_= sizeof(server_address_);
-        if (connect(client_socket_, (struct sockaddr*)&server_address_, (socklen_t)server_address_size_) == -1) {
-            throw network_error("connect() error");
+        bool is_shm = !net_shm_path(ip_address).empty();
+        client_socket_ = connect_socket(ip_address, port_no);
+        int features = protocol_features();
+        int threshold = atoi(coral::config::instance()->get_value("NET_CLIENT_COMPRESSION_THRESHOLD").c_str());
+        if (is_shm) {
+            shm_channel_.reset(new coral::net_shm_channel_t());
+            if (threshold > 0) {
+                shm_channel_->codec().compression_threshold(threshold);
+            }
+            size_t ring_size = strtoul(coral::config::instance()->get_value("NET_CLIENT_SHM_RING_SIZE").c_str(), nullptr, 10);
+            shm_channel_->offer(client_socket_, features, ring_size);
+            shm_channel_->busy_poll_us(atoi(coral::config::instance()->get_value("NET_CLIENT_SHM_BUSY_POLL_US").c_str()));
+        }
+        else {
+            channel_.attach(client_socket_);
+            if (features != NET_PROTOCOL_FEATURE_NONE) {
+                if (threshold > 0) {
+                    channel_.compression_threshold(threshold);
+                }
+                channel_.negotiate(features);
+            }
+        }
+        if (codec().uses_batch()) {
+            batch_max_bytes_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_BATCH_BYTES").c_str(), nullptr, 10);
+            batch_max_count_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_BATCH_COUNT").c_str(), nullptr, 10);
+            batch_linger_ms_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_BATCH_LINGER_MS").c_str(), nullptr, 10);
+            if (batch_linger_ms_ > 0 && !linger_thread_.joinable()) {
+                is_linger_stopped_ = false;
+                linger_thread_ = std::thread([this] { linger_batch(); });
+            }
+        }
+        if (!is_shm && coral::config::instance()->get_value("NET_CLIENT_USING_IO_URING") == "TRUE") {
+            try {
+                ring_.reset(new coral::net_uring_t(4));
+            }
+            catch (coral::network_error& error) {
+                coral::log_manager::write(gv_app_name, method_info.str() + "falls back to write and read:" + error.what());
+            }
         }
     }
     catch (coral::exception& error) {
@@ -69,8 +108,7 @@ void coral::net_client::run(coral::net_msg_t& msg)
     std::ostringstream method_info;
     method_info << CORAL_D_METHOD_INFO << "(" << &msg << "):";
     try {
-        msg.write_to_network(get_socket());
-        msg.read_from_network(get_socket());
+        request(msg);
         std::cout << "[SERVER MSG]:" << msg << '\n';
     }
     catch (coral::exception& error) {
@@ -87,3 +125,360 @@ void coral::net_client::run(coral::net_msg_t& msg)
     coral::log_manager::write(gv_app_name, method_info.str() + log_message);
     CORAL_D_CLASS_MEMBER_FUNC_END;
 }
+
+void coral::net_client::request(coral::net_msg_t& msg)
+{
+    // the open batch goes out with the request
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    round_trip(msg);
+}
+
+int coral::net_client::connect_socket(const std::string& ip_address, const std::string& port_no)
+{
+    std::ostringstream method_info;
+    method_info << CORAL_D_FUNCTION_INFO << "(" << ip_address << ',' << port_no << "):";
+    int timeout_ms = atoi(coral::config::instance()->get_value("NET_CLIENT_CONNECT_TIMEOUT_MS").c_str());
+    int attempts = std::max(1, atoi(coral::config::instance()->get_value("NET_CLIENT_CONNECT_ATTEMPTS").c_str()));
+    int64_t backoff_ms = atoi(coral::config::instance()->get_value("NET_CLIENT_CONNECT_BACKOFF_MS").c_str());
+    int64_t max_backoff_ms = atoi(coral::config::instance()->get_value("NET_CLIENT_CONNECT_MAX_BACKOFF_MS").c_str());
+    std::string unix_path = net_unix_path(ip_address);
+    if (unix_path.empty()) {
+        unix_path = net_shm_path(ip_address);
+    }
+    static thread_local std::mt19937 generator(std::random_device{}());
+    std::string error;
+    std::string log_message;
+    for (int attempt = 1; ; attempt++) {
+        coral::elapsed_time et;
+        int fd = unix_path.empty() ? connect_inet(ip_address, port_no, timeout_ms, error) : connect_unix(unix_path, timeout_ms, error);
+        if (fd >= 0) {
+            coral::print_string(log_message, gv_string_msg_size, "attempt %d/%d connected in %.6lfs", attempt, attempts, et.sec());
+            coral::log_manager::write(gv_app_name, method_info.str() + log_message);
+            return fd;
+        }
+        coral::print_string(log_message, gv_string_msg_size, "attempt %d/%d failed in %.6lfs:", attempt, attempts, et.sec());
+        coral::log_manager::write(gv_app_name, method_info.str() + log_message + error);
+        if (attempt >= attempts) {
+            break;
+        }
+        // exponential backoff with jitter, the clients of a restarted server don't come back all at once
+        if (backoff_ms > 0) {
+            int64_t delay_ms = backoff_ms << std::min(attempt - 1, 20);
+            if (max_backoff_ms > 0) {
+                delay_ms = std::min(delay_ms, max_backoff_ms);
+            }
+            std::uniform_int_distribution<int64_t> jitter(delay_ms / 2, delay_ms);
+            std::this_thread::sleep_for(std::chrono::milliseconds(jitter(generator)));
+        }
+    }
+    throw network_error("connect() error:" + error);
+}
+
+int coral::net_client::connect_inet(const std::string& host, const std::string& port_no, int timeout_ms, std::string& error)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    int result = getaddrinfo(host.c_str(), port_no.c_str(), &hints, &addresses);
+    if (result == EAI_AGAIN) {
+        error = std::string("getaddrinfo() error:") + gai_strerror(result);
+        return -1;
+    }
+    if (result != 0) {
+        // a wrong name doesn't get better with retries
+        throw network_error(std::string("getaddrinfo() error:") + gai_strerror(result));
+    }
+    // the addresses share the timeout of an attempt
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+        int remaining_ms = 0;
+        if (timeout_ms > 0) {
+            remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining_ms <= 0) {
+                error = std::strerror(ETIMEDOUT);
+                break;
+            }
+        }
+        fd = socket(address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            error = std::string("socket() error:") + std::strerror(errno);
+            continue;
+        }
+        int connect_error = connect_until(fd, address->ai_addr, address->ai_addrlen, remaining_ms);
+        if (connect_error == 0) {
+            break;
+        }
+        char host_name[NI_MAXHOST] = "";
+        getnameinfo(address->ai_addr, address->ai_addrlen, host_name, sizeof(host_name), nullptr, 0, NI_NUMERICHOST);
+        error = std::string(host_name) + ':' + std::strerror(connect_error);
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+int coral::net_client::connect_unix(const std::string& path, int timeout_ms, std::string& error)
+{
+    struct sockaddr_un unix_address;
+    socklen_t unix_address_size = net_unix_address(path, unix_address);
+    if (unix_address_size == 0) {
+        throw network_error("unix socket path error");
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = std::string("socket() error:") + std::strerror(errno);
+        return -1;
+    }
+    int connect_error = connect_until(fd, (struct sockaddr*)&unix_address, unix_address_size, timeout_ms);
+    if (connect_error != 0) {
+        error = path + ':' + std::strerror(connect_error);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int coral::net_client::connect_until(int fd, const struct sockaddr* address, socklen_t address_size, int timeout_ms)
+{
+    if (timeout_ms <= 0) {
+        return connect(fd, address, address_size) == 0 ? 0 : errno;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int error = 0;
+    if (connect(fd, address, address_size) < 0) {
+        error = errno;
+        // a unix domain socket with a full backlog answers EAGAIN instead of waiting
+        if (error == EINPROGRESS) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            struct pollfd poll_fd;
+            poll_fd.fd = fd;
+            poll_fd.events = POLLOUT;
+            int n = 0;
+            do {
+                poll_fd.revents = 0;
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                n = poll(&poll_fd, 1, std::max<int64_t>(remaining, 0));
+            } while (n < 0 && errno == EINTR);
+            if (n == 0) {
+                error = ETIMEDOUT;
+            }
+            else if (n < 0) {
+                error = errno;
+            }
+            else {
+                socklen_t error_size = sizeof(error);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_size);
+            }
+        }
+    }
+    // the client reads and writes with blocking calls
+    fcntl(fd, F_SETFL, flags);
+    return error;
+}
+
+int coral::net_client::protocol_features()
+{
+    if (coral::config::instance()->get_value("NET_CLIENT_USING_FRAME") != "TRUE") {
+        return NET_PROTOCOL_FEATURE_NONE;
+    }
+    int features = NET_PROTOCOL_FEATURE_FRAME;
+    if (coral::config::instance()->get_value("NET_CLIENT_USING_KEY_DICTIONARY") == "TRUE") {
+        features |= NET_PROTOCOL_FEATURE_KEY_DICTIONARY;
+    }
+    if (coral::config::instance()->get_value("NET_CLIENT_USING_COMPRESSION") == "TRUE") {
+        features |= NET_PROTOCOL_FEATURE_COMPRESSION;
+    }
+    if (coral::config::instance()->get_value("NET_CLIENT_USING_BATCH") == "TRUE") {
+        features |= NET_PROTOCOL_FEATURE_BATCH;
+    }
+    return features;
+}
+
+void coral::net_client::post(const coral::net_msg_t& msg)
+{
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    net_channel_t& channel = codec();
+    if (!channel.uses_batch()) {
+        net_msg_t reply = msg;
+        round_trip(reply);
+        return;
+    }
+    bool is_opened = channel.batch_count() == 0;
+    channel.encode_batched(msg);
+    if ((batch_max_count_ > 0 && channel.batch_count() >= batch_max_count_)
+        || (batch_max_bytes_ > 0 && channel.batch_bytes() >= batch_max_bytes_)) {
+        send_batch();
+    }
+    else if (is_opened) {
+        batch_started_ = std::chrono::steady_clock::now();
+        batch_opened_.notify_one();
+    }
+}
+
+void coral::net_client::flush_batch()
+{
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    send_batch();
+}
+
+void coral::net_client::round_trip(coral::net_msg_t& msg)
+{
+    try {
+        transfer(msg);
+    }
+    catch (...) {
+        // a reply may be left on the connection, the next request would read it
+        is_broken_ = true;
+        throw;
+    }
+}
+
+void coral::net_client::transfer(coral::net_msg_t& msg)
+{
+    if (shm_channel_) {
+        if (shm_channel_->write_msg(msg) < 0) {
+            throw network_error("shared memory write error");
+        }
+        if (shm_channel_->read_msg(msg) <= 0) {
+            throw network_error("shared memory read error");
+        }
+    }
+    else if (ring_) {
+        exchange(msg);
+    }
+    else {
+        if (channel_.write_msg(msg) < 0) {
+            throw network_error("write() error");
+        }
+        if (channel_.read_msg(msg) <= 0) {
+            throw network_error("read() error");
+        }
+    }
+}
+
+void coral::net_client::send_batch()
+{
+    if (codec().batch_count() == 0) {
+        return;
+    }
+    int n = shm_channel_ ? shm_channel_->flush() : channel_.flush();
+    if (n < 0) {
+        is_broken_ = true;
+        throw network_error("batch write error");
+    }
+}
+
+void coral::net_client::linger_batch()
+{
+    std::unique_lock<std::mutex> lock(batch_mutex_);
+    while (!is_linger_stopped_) {
+        if (codec().batch_count() == 0) {
+            batch_opened_.wait(lock);
+            continue;
+        }
+        auto deadline = batch_started_ + std::chrono::milliseconds(batch_linger_ms_);
+        if (std::chrono::steady_clock::now() < deadline) {
+            batch_opened_.wait_until(lock, deadline);
+            continue;
+        }
+        try {
+            send_batch();
+        }
+        catch (std::exception& error) {
+            // the next call on the connection fails too and tells the caller
+            coral::log_manager::write(gv_app_name, std::string("net_client::linger_batch():") + error.what());
+        }
+    }
+}
+
+void coral::net_client::stop_linger()
+{
+    if (!linger_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        is_linger_stopped_ = true;
+    }
+    batch_opened_.notify_one();
+    linger_thread_.join();
+}
+
+bool coral::net_client::is_alive()
+{
+    if (client_socket_ <= 0 || is_broken_) {
+        return false;
+    }
+    struct pollfd poll_fd;
+    poll_fd.fd = client_socket_;
+    poll_fd.events = POLLIN | POLLRDHUP;
+    poll_fd.revents = 0;
+    return poll(&poll_fd, 1, 0) == 0;
+}
+
+void coral::net_client::exchange(coral::net_msg_t& msg)
+{
+    const size_t recv_size = 0x10000;   // same as net_channel_t::fill()
+    const uint64_t send_data = 1, recv_data = 2;
+    channel_.encode(msg);
+    net_buffer_t& send_buffer = channel_.send_buffer();
+    // both are taken right after the check, the ring has room for them
+    struct io_uring_sqe* send_sqe = ring_->get_sqe();
+    struct io_uring_sqe* recv_sqe = ring_->get_sqe();
+    send_sqe->opcode = IORING_OP_SEND;
+    send_sqe->fd = client_socket_;
+    send_sqe->addr = reinterpret_cast<uint64_t>(send_buffer.data());
+    send_sqe->len = static_cast<uint32_t>(std::min<size_t>(send_buffer.size(), UINT32_MAX));
+    send_sqe->msg_flags = MSG_NOSIGNAL;
+    send_sqe->user_data = send_data;
+    recv_sqe->opcode = IORING_OP_RECV;
+    recv_sqe->fd = client_socket_;
+    recv_sqe->addr = reinterpret_cast<uint64_t>(channel_.recv_buffer().prepare(recv_size));
+    recv_sqe->len = recv_size;
+    recv_sqe->user_data = recv_data;
+
+    bool is_sent = false, is_received = false, is_failed = false;
+    int received = 0;
+    unsigned int wait_count = 2;
+    while (!is_sent || !is_received) {
+        if (ring_->submit(wait_count) < 0 && errno != EINTR) {
+            // the receive may be still in flight on the buffer, the connection can't be used any more
+            close_socket();
+            client_socket_ = 0;
+            ring_.reset();
+            throw network_error("io_uring_enter() error");
+        }
+        wait_count = 1;
+        ring_->for_each_cqe([&](uint64_t user_data, int res) {
+            if (user_data == send_data) {
+                is_sent = true;
+                if (res > 0) send_buffer.consume(res);
+                // a short send is finished with blocking writes, the receive waits for the whole request
+                if (res < 0 || (!send_buffer.empty() && channel_.flush() < 0)) {
+                    is_failed = true;
+                    shutdown(client_socket_, SHUT_RDWR);
+                }
+            }
+            else if (user_data == recv_data) {
+                is_received = true;
+                received = res;
+            }
+        });
+    }
+    if (is_failed) {
+        send_buffer.clear();
+        throw network_error("write() error");
+    }
+    if (received <= 0) {
+        throw network_error("read() error");
+    }
+    channel_.recv_buffer().commit(received);
+    if (channel_.read_msg(msg) <= 0) {
+        throw network_error("read() error");
+    }
+}
@@ -11,10 +11,21 @@
 #define __CORAL_NETCLIENT_H__
 
 #include "utility.h"
+#include "net_channel.h"
+#include "net_uring.h"
+#include "net_shm.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 //! Core Library for Applications and Libraries
 namespace coral {
     //! client socket class
+    /*!
+        a connection to a net_server, run() and request() send a request and receive its reply,
+        post() sends a one-way message.
+    */
     class net_client {
     public:
         //! default construct
@@ -22,8 +33,46 @@ namespace coral {
         //! default destruct
         virtual ~net_client();
         // overriden function
+        /*! connect to a server with connect_socket().
+            "shm:/path" offers a shared memory segment of NET_CLIENT_SHM_RING_SIZE bytes a direction
+            to the server on the unix domain socket and the messages go through it
+        */
         virtual int init_socket(const std::string& ip_address, const std::string& port_no);
+        /*! send a request and print the reply, the open batch goes out first.
+            with NET_CLIENT_USING_IO_URING=TRUE the request and the first read of the reply are
+            submitted in one io_uring_enter call instead of a write and a read
+        */
         virtual void run(coral::net_msg_t& msg);
+        /*! send a request and receive the reply, without the console output and the log of run()
+            \param msg request, it gets the reply
+            \exception network_error the write or the read failed
+        */
+        void request(coral::net_msg_t& msg);
+        /*! send a one-way message, it is batched if the server accepted the batch feature.
+            a batch is sent at NET_CLIENT_BATCH_BYTES or NET_CLIENT_BATCH_COUNT messages, by a linger
+            thread NET_CLIENT_BATCH_LINGER_MS after its first message, or before a request.
+            without it the message is sent as a request and the reply is dropped
+            \param msg message, the server handles it without a reply
+        */
+        void post(const coral::net_msg_t& msg);
+        //! send the open batch now
+        void flush_batch();
+        //! is the connection still usable? an idle connection with EOF or stray bytes to read isn't
+        bool is_alive();
+        //! did a write or a read of the connection fail? the connection isn't usable any more then
+        bool is_broken() const { return is_broken_; }
+        /*! connect a socket to a server, "unix:/path" and "shm:/path" connect to the unix domain socket.
+            an attempt times out in NET_CLIENT_CONNECT_TIMEOUT_MS, a failed attempt is retried up to
+            NET_CLIENT_CONNECT_ATTEMPTS after an exponential backoff with jitter from
+            NET_CLIENT_CONNECT_BACKOFF_MS to NET_CLIENT_CONNECT_MAX_BACKOFF_MS, each attempt is logged.
+            \param ip_address host name or address, IPv4 or IPv6
+            \param port_no port number or service name
+            \return connected socket
+            \exception network_error the last attempt failed or the host name is unknown
+        */
+        static int connect_socket(const std::string& ip_address, const std::string& port_no);
+        //! NET_PROTOCOL_FEATURE flags of the config which a client asks for
+        static int protocol_features();
 
     protected:
         //! get connected socket
@@ -35,9 +84,50 @@ namespace coral {
             }
         }
 
+        /*! send a message and receive the reply in one io_uring submission
+            \param msg request, it gets the reply
+        */
+        void exchange(coral::net_msg_t& msg);
+
     private:
+        //! send a request and receive the reply on the channel in use, the connection is broken if it throws
+        void round_trip(coral::net_msg_t& msg);
+        //! the write and the read of round_trip()
+        void transfer(coral::net_msg_t& msg);
+        //! codec of the channel in use
+        coral::net_channel_t& codec() { return shm_channel_ ? shm_channel_->codec() : channel_; }
+        //! send the open batch, batch_mutex_ has to be held
+        void send_batch();
+        //! linger thread, it sends a batch which is older than the linger time
+        void linger_batch();
+        //! stop the linger thread
+        void stop_linger();
+        /*! an attempt to connect a TCP socket to the addresses of a host in turn
+            \param error reason of the failure
+            \return connected socket, -1 if it failed
+        */
+        static int connect_inet(const std::string& host, const std::string& port_no, int timeout_ms, std::string& error);
+        //! an attempt to connect a unix domain socket, like connect_inet()
+        static int connect_unix(const std::string& path, int timeout_ms, std::string& error);
+        /*! connect a socket within a timeout, the socket is blocking again after it
+            \param timeout_ms 0 is a blocking connect without a limit
+            \return 0, errno of the failure or ETIMEDOUT
+        */
+        static int connect_until(int fd, const struct sockaddr* address, socklen_t address_size, int timeout_ms);
+
         int client_socket_;
-        struct sockaddr_in server_address_;
+        bool is_broken_ = false;            ///< did a write or a read fail?
+        coral::net_channel_t channel_;      ///< message channel of the connection
+        std::unique_ptr<coral::net_uring_t> ring_;  ///< io_uring of the connection, nullptr without io_uring
+        std::unique_ptr<coral::net_shm_channel_t> shm_channel_;    ///< shared memory channel, nullptr on a socket
+        std::mutex batch_mutex_;            ///< lock of the channel between the caller and the linger thread
+        std::condition_variable batch_opened_;  ///< a batch is opened or the linger thread is stopped
+        std::thread linger_thread_;         ///< linger thread, not running without batches
+        bool is_linger_stopped_ = false;    ///< stop flag of the linger thread
+        std::chrono::steady_clock::time_point batch_started_;   ///< time of the first message of the open batch
+        size_t batch_max_bytes_ = 0;        ///< bytes which send a batch, 0 is no limit
+        size_t batch_max_count_ = 0;        ///< messages which send a batch, 0 is no limit
+        uint32_t batch_linger_ms_ = 0;      ///< milliseconds a batch waits for more messages, 0 waits for the limits
     }; // end net_client class
 } // end coral namespace
 
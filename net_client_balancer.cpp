@@ -0,0 +1,211 @@
+/*!
+    \file       net_client_balancer.cpp
+    \brief      Client side load balancer of network servers
+    \details    consistent hashing or the least outstanding requests over the endpoints of identical servers
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#include "net_client_balancer.h"
+#include "log_manager.h"
+
+//! global application name
+extern std::string gv_app_name;
+
+namespace {
+    //! FNV-1a with a final mix, it is the same in every process unlike std::hash
+    uint64_t hash_of(const std::string& key)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 0x100000001b3ULL;
+        }
+        // FNV leaves similar keys close, the mix spreads them over the ring
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+}
+
+coral::net_client_balancer::net_client_balancer(const std::vector<std::string>& endpoints)
+{
+    CORAL_D_CLASS_MEMBER_FUNC_START;
+    if (endpoints.empty()) {
+        throw domain_error("no endpoint to balance");
+    }
+    int vnodes = atoi(coral::config::instance()->get_value("NET_CLIENT_BALANCER_VNODES").c_str());
+    if (vnodes <= 0) {
+        vnodes = 160;
+    }
+    max_failures_ = atoi(coral::config::instance()->get_value("NET_CLIENT_BALANCER_MAX_FAILS").c_str());
+    eject_ms_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_BALANCER_EJECT_MS").c_str(), nullptr, 10);
+    attempts_ = std::max(1, atoi(coral::config::instance()->get_value("NET_CLIENT_BALANCER_ATTEMPTS").c_str()));
+    for (const auto& name : endpoints) {
+        std::unique_ptr<endpoint_t> endpoint(new endpoint_t());
+        endpoint->name = name;
+        if (!net_unix_path(name).empty() || !net_shm_path(name).empty()) {
+            endpoint->ip_address = name;
+        }
+        else {
+            size_t colon = name.rfind(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == name.size()) {
+                throw domain_error("endpoint isn't address:port:" + name);
+            }
+            endpoint->ip_address = name.substr(0, colon);
+            endpoint->port_no = name.substr(colon + 1);
+            if (endpoint->ip_address.front() == '[' && endpoint->ip_address.back() == ']') {
+                endpoint->ip_address = endpoint->ip_address.substr(1, endpoint->ip_address.size() - 2);
+            }
+        }
+        for (int i = 0; i < vnodes; i++) {
+            ring_.emplace_back(hash_of(name + '#' + std::to_string(i)), endpoints_.size());
+        }
+        endpoints_.push_back(std::move(endpoint));
+    }
+    std::sort(ring_.begin(), ring_.end());
+    CORAL_D_CLASS_MEMBER_FUNC_END;
+}
+
+void coral::net_client_balancer::run(const std::string& key, coral::net_msg_t& msg)
+{
+    route(&key, msg);
+}
+
+void coral::net_client_balancer::run(coral::net_msg_t& msg)
+{
+    route(nullptr, msg);
+}
+
+std::string coral::net_client_balancer::endpoint_of(const std::string& key)
+{
+    return endpoints_[pick(&key, std::vector<bool>(endpoints_.size(), false))]->name;
+}
+
+bool coral::net_client_balancer::is_ejected(const std::string& endpoint)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t now_ms = steady_ms();
+    for (const auto& item : endpoints_) {
+        if (item->name == endpoint) {
+            return item->ejected_until_ms > now_ms;
+        }
+    }
+    return false;
+}
+
+void coral::net_client_balancer::route(const std::string* key, coral::net_msg_t& msg)
+{
+    std::vector<bool> tried(endpoints_.size(), false);
+    for (int attempt = 1; ; attempt++) {
+        size_t index = pick(key, tried);
+        if (index == endpoints_.size()) {
+            throw network_error("no endpoint left to try");
+        }
+        tried[index] = true;
+        endpoint_t& endpoint = *endpoints_[index];
+        endpoint.outstanding.fetch_add(1);
+        net_client_pool::lease_t lease;
+        try {
+            lease = pool_.borrow(endpoint.ip_address, endpoint.port_no);
+        }
+        catch (pool_exhausted_error&) {
+            // the limits of this pool, not a failure of the endpoint
+            endpoint.outstanding.fetch_sub(1);
+            throw;
+        }
+        catch (coral::exception&) {
+            // net_client::init_socket() rethrows its errors as coral::exception
+            endpoint.outstanding.fetch_sub(1);
+            record(endpoint, false);
+            // the request hasn't been sent, another endpoint can take it
+            if (attempt >= attempts_) {
+                throw;
+            }
+            continue;
+        }
+        try {
+            lease->request(msg);
+        }
+        catch (...) {
+            endpoint.outstanding.fetch_sub(1);
+            lease.invalidate();
+            record(endpoint, false);
+            throw;
+        }
+        endpoint.outstanding.fetch_sub(1);
+        record(endpoint, true);
+        return;
+    }
+}
+
+size_t coral::net_client_balancer::pick(const std::string* key, const std::vector<bool>& tried)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t now_ms = steady_ms();
+    size_t fallback = endpoints_.size();
+    if (key != nullptr) {
+        // clockwise from the point of the key
+        auto point = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(hash_of(*key), size_t(0)));
+        for (size_t i = 0; i < ring_.size(); i++, point++) {
+            if (point == ring_.end()) {
+                point = ring_.begin();
+            }
+            size_t index = point->second;
+            if (tried[index]) {
+                continue;
+            }
+            if (endpoints_[index]->ejected_until_ms <= now_ms) {
+                return index;
+            }
+            if (fallback == endpoints_.size()) {
+                fallback = index;
+            }
+        }
+        return fallback;
+    }
+    // a tie is broken at random, an ejected endpoint doesn't hand its turns to its neighbor
+    static thread_local std::minstd_rand generator(std::random_device{}());
+    size_t best = endpoints_.size();
+    int best_outstanding = 0;
+    size_t tie_size = 0;
+    for (size_t index = 0; index < endpoints_.size(); index++) {
+        if (tried[index]) {
+            continue;
+        }
+        if (endpoints_[index]->ejected_until_ms > now_ms) {
+            if (fallback == endpoints_.size()) {
+                fallback = index;
+            }
+            continue;
+        }
+        int outstanding = endpoints_[index]->outstanding.load();
+        if (best == endpoints_.size() || outstanding < best_outstanding) {
+            best = index;
+            best_outstanding = outstanding;
+            tie_size = 1;
+        }
+        else if (outstanding == best_outstanding && generator() % ++tie_size == 0) {
+            best = index;
+        }
+    }
+    return best != endpoints_.size() ? best : fallback;
+}
+
+void coral::net_client_balancer::record(endpoint_t& endpoint, bool is_succeeded)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (is_succeeded) {
+        endpoint.failures = 0;
+        return;
+    }
+    endpoint.failures++;
+    if (max_failures_ > 0 && endpoint.failures >= max_failures_) {
+        endpoint.failures = 0;
+        endpoint.ejected_until_ms = steady_ms() + eject_ms_;
+        coral::log_manager::write(gv_app_name, "net_client_balancer:" + endpoint.name + " is ejected for " + std::to_string(eject_ms_) + "ms");
+    }
+}
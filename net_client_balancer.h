@@ -0,0 +1,96 @@
+/*!
+    \file       net_client_balancer.h
+    \brief      Client side load balancer of network servers
+    \details    consistent hashing or the least outstanding requests over the endpoints of identical servers
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#ifndef __CORAL_NETCLIENTBALANCER_H__
+#define __CORAL_NETCLIENTBALANCER_H__
+
+#include "net_client_pool.h"
+#include <atomic>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! client side load balancer over identical servers
+    /*!
+        run(key, msg) sends a request to the endpoint of the key on a consistent hash ring, each
+        endpoint has NET_CLIENT_BALANCER_VNODES points on the ring so the keys spread evenly and
+        only the keys of an endpoint move when it is added, removed or ejected. run(msg) sends a
+        request to the endpoint with the least outstanding requests of this balancer.
+        an endpoint failing NET_CLIENT_BALANCER_MAX_FAILS times in a row is ejected for
+        NET_CLIENT_BALANCER_EJECT_MS and its keys go to the next endpoints on the ring meanwhile,
+        if all are ejected they are tried anyway. a request whose connect failed is tried on up to
+        NET_CLIENT_BALANCER_ATTEMPTS endpoints, a request failed after it was sent isn't retried
+        because the server may have handled it. the connections come from a net_client_pool, its
+        pool_exhausted_error is thrown to the caller and isn't counted as a failure of the endpoint.
+    */
+    class net_client_balancer {
+    public:
+        /*! constructor, load the limits of the config
+            \param endpoints "address:port", "[IPv6 address]:port", "unix:/path" or "shm:/path" of the servers
+        */
+        explicit net_client_balancer(const std::vector<std::string>& endpoints);
+        net_client_balancer(const net_client_balancer&) = delete;
+        net_client_balancer& operator=(const net_client_balancer&) = delete;
+
+        /*! send a request to the endpoint of a key and receive the reply, it is thread safe
+            \param key routing key, the same key goes to the same endpoint while it is healthy
+            \param msg request, it gets the reply
+            \exception coral::exception all the tried endpoints failed
+            \exception pool_exhausted_error all the clients of the endpoint are borrowed
+        */
+        void run(const std::string& key, coral::net_msg_t& msg);
+        /*! send a request to the endpoint with the least outstanding requests, it is thread safe
+            \param msg request, it gets the reply
+            \exception coral::exception all the tried endpoints failed
+            \exception pool_exhausted_error all the clients of the endpoint are borrowed
+        */
+        void run(coral::net_msg_t& msg);
+        /*! the endpoint which a key goes to now
+            \return endpoint as given to the constructor
+        */
+        std::string endpoint_of(const std::string& key);
+        //! is an endpoint ejected now?
+        bool is_ejected(const std::string& endpoint);
+        //! pool of the connections
+        net_client_pool& pool() { return pool_; }
+
+    private:
+        //! a server
+        struct endpoint_t {
+            std::string name;                   ///< endpoint as given
+            std::string ip_address;             ///< address for net_client::init_socket()
+            std::string port_no;                ///< port for net_client::init_socket()
+            std::atomic<int> outstanding{0};    ///< requests in flight
+            int failures = 0;                   ///< consecutive failures, guarded by mutex_
+            uint64_t ejected_until_ms = 0;      ///< it is skipped until this time, guarded by mutex_
+        };
+
+        /*! send a request to the picked endpoints until one takes it
+            \param key routing key, nullptr for the least outstanding requests
+        */
+        void route(const std::string* key, coral::net_msg_t& msg);
+        /*! pick an endpoint which isn't tried yet
+            \param key routing key, nullptr for the least outstanding requests
+            \param tried endpoints tried already
+            \return index of the endpoint, endpoints_.size() if all are tried
+        */
+        size_t pick(const std::string* key, const std::vector<bool>& tried);
+        //! count a success or a failure of an endpoint, eject it after too many failures
+        void record(endpoint_t& endpoint, bool is_succeeded);
+
+        net_client_pool pool_;                                  ///< connections of the endpoints
+        std::vector<std::unique_ptr<endpoint_t>> endpoints_;    ///< servers
+        std::vector<std::pair<uint64_t, size_t>> ring_;         ///< hash ring, points and endpoint indexes sorted by the points
+        std::mutex mutex_;                                      ///< lock of the failures and the ejections
+        int max_failures_ = 0;                                  ///< consecutive failures to eject an endpoint
+        uint32_t eject_ms_ = 0;                                 ///< milliseconds an endpoint is ejected for
+        int attempts_ = 1;                                      ///< endpoints to try for a request which couldn't be sent
+    }; // class net_client_balancer
+} // end coral namespace
+
+#endif // __CORAL_NETCLIENTBALANCER_H__
@@ -0,0 +1,203 @@
+/*!
+    \file       net_client_pool.cpp
+    \brief      Pool of connected network clients
+    \details    thread safe pool of net_client connections keyed by endpoint
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#include "net_client_pool.h"
+#include "log_manager.h"
+
+//! global application name
+extern std::string gv_app_name;
+
+coral::net_client_pool::lease_t& coral::net_client_pool::lease_t::operator=(lease_t&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        endpoint_ = other.endpoint_;
+        client_ = std::move(other.client_);
+        is_valid_ = other.is_valid_;
+        other.pool_ = nullptr;
+        other.endpoint_ = nullptr;
+    }
+    return *this;
+}
+
+void coral::net_client_pool::lease_t::release()
+{
+    if (client_ == nullptr) {
+        return;
+    }
+    bool is_reusable = is_valid();
+    pool_->give_back(*endpoint_, std::move(client_), is_reusable);
+    pool_ = nullptr;
+    endpoint_ = nullptr;
+}
+
+coral::net_client_pool::net_client_pool()
+{
+    CORAL_D_CLASS_MEMBER_FUNC_START;
+    min_size_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_POOL_MIN_SIZE").c_str(), nullptr, 10);
+    max_size_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_POOL_MAX_SIZE").c_str(), nullptr, 10);
+    idle_timeout_ms_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_POOL_IDLE_TIMEOUT_MS").c_str(), nullptr, 10);
+    wait_timeout_ms_ = strtoul(coral::config::instance()->get_value("NET_CLIENT_POOL_WAIT_TIMEOUT_MS").c_str(), nullptr, 10);
+    CORAL_D_CLASS_MEMBER_FUNC_END;
+}
+
+coral::net_client_pool::~net_client_pool()
+{
+    CORAL_D_CLASS_MEMBER_FUNC_START;
+    endpoints_.clear();
+    CORAL_D_CLASS_MEMBER_FUNC_END;
+}
+
+coral::net_client_pool::lease_t coral::net_client_pool::borrow(const std::string& ip_address, const std::string& port_no)
+{
+    lease_t lease;
+    std::vector<std::unique_ptr<net_client>> stale;
+    std::unique_lock<std::mutex> lock(mutex_);
+    endpoint_t& endpoint = endpoint_of(ip_address, port_no);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_timeout_ms_);
+    while (true) {
+        if (!endpoint.idle.empty()) {
+            std::unique_ptr<net_client> client = std::move(endpoint.idle.back().client);
+            endpoint.idle.pop_back();
+            take_stale(endpoint, steady_ms(), stale);
+            lock.unlock();
+            stale.clear();
+            // the server may have closed it while it was idle
+            if (client->is_alive()) {
+                lease.pool_ = this;
+                lease.endpoint_ = &endpoint;
+                lease.client_ = std::move(client);
+                return lease;
+            }
+            client.reset();
+            lock.lock();
+            endpoint.size--;
+            continue;
+        }
+        if (max_size_ == 0 || endpoint.size < max_size_) {
+            break;
+        }
+        if (endpoint.returned.wait_until(lock, deadline) == std::cv_status::timeout && endpoint.idle.empty()
+            && endpoint.size >= max_size_) {
+            throw pool_exhausted_error(ip_address + ':' + port_no);
+        }
+    }
+    // a new connection, its slot is taken before the connect so max_size_ holds
+    endpoint.size++;
+    lock.unlock();
+    lease.client_ = connect(endpoint);
+    lease.pool_ = this;
+    lease.endpoint_ = &endpoint;
+    return lease;
+}
+
+void coral::net_client_pool::warm_up(const std::string& ip_address, const std::string& port_no)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    endpoint_t& endpoint = endpoint_of(ip_address, port_no);
+    while (endpoint.size < min_size_) {
+        endpoint.size++;
+        lock.unlock();
+        std::unique_ptr<net_client> client = connect(endpoint);
+        lock.lock();
+        endpoint.idle.push_front(idle_client_t{std::move(client), steady_ms()});
+    }
+}
+
+void coral::net_client_pool::evict_idle()
+{
+    std::vector<std::unique_ptr<net_client>> stale;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t now_ms = steady_ms();
+        for (auto& item : endpoints_) {
+            take_stale(*item.second, now_ms, stale);
+        }
+    }
+}
+
+size_t coral::net_client_pool::size(const std::string& ip_address, const std::string& port_no)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    endpoint_t* endpoint = find_endpoint(ip_address, port_no);
+    return endpoint != nullptr ? endpoint->size : 0;
+}
+
+size_t coral::net_client_pool::idle_size(const std::string& ip_address, const std::string& port_no)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    endpoint_t* endpoint = find_endpoint(ip_address, port_no);
+    return endpoint != nullptr ? endpoint->idle.size() : 0;
+}
+
+coral::net_client_pool::endpoint_t& coral::net_client_pool::endpoint_of(const std::string& ip_address, const std::string& port_no)
+{
+    std::unique_ptr<endpoint_t>& endpoint = endpoints_[ip_address + ':' + port_no];
+    if (endpoint == nullptr) {
+        endpoint.reset(new endpoint_t());
+        endpoint->ip_address = ip_address;
+        endpoint->port_no = port_no;
+    }
+    return *endpoint;
+}
+
+coral::net_client_pool::endpoint_t* coral::net_client_pool::find_endpoint(const std::string& ip_address, const std::string& port_no)
+{
+    auto it = endpoints_.find(ip_address + ':' + port_no);
+    return it != endpoints_.end() ? it->second.get() : nullptr;
+}
+
+std::unique_ptr<coral::net_client> coral::net_client_pool::connect(endpoint_t& endpoint)
+{
+    try {
+        std::unique_ptr<net_client> client(new net_client());
+        client->init_socket(endpoint.ip_address, endpoint.port_no);
+        return client;
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            endpoint.size--;
+        }
+        endpoint.returned.notify_one();
+        throw;
+    }
+}
+
+void coral::net_client_pool::take_stale(endpoint_t& endpoint, uint64_t now_ms, std::vector<std::unique_ptr<net_client>>& stale)
+{
+    if (idle_timeout_ms_ == 0) {
+        return;
+    }
+    // the least recently used clients are at the front
+    while (!endpoint.idle.empty() && endpoint.size > min_size_ && now_ms - endpoint.idle.front().idle_ms >= idle_timeout_ms_) {
+        stale.push_back(std::move(endpoint.idle.front().client));
+        endpoint.idle.pop_front();
+        endpoint.size--;
+    }
+}
+
+void coral::net_client_pool::give_back(endpoint_t& endpoint, std::unique_ptr<net_client> client, bool is_valid)
+{
+    std::vector<std::unique_ptr<net_client>> stale;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t now_ms = steady_ms();
+        if (is_valid) {
+            endpoint.idle.push_back(idle_client_t{std::move(client), now_ms});
+        }
+        else {
+            endpoint.size--;
+        }
+        take_stale(endpoint, now_ms, stale);
+    }
+    endpoint.returned.notify_one();
+    // the sockets are closed out of the lock
+}
@@ -0,0 +1,153 @@
+/*!
+    \file       net_client_pool.h
+    \brief      Pool of connected network clients
+    \details    thread safe pool of net_client connections keyed by endpoint
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#ifndef __CORAL_NETCLIENTPOOL_H__
+#define __CORAL_NETCLIENTPOOL_H__
+
+#include "net_client.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! pool of connected clients keyed by endpoint
+    /*!
+        borrow() hands out an idle client of an endpoint and connects a new one only if there is
+        none, so a short request doesn't pay for a connect. the idle clients of an endpoint are a
+        stack, borrow() takes the most recently used one and eviction takes the least recently used
+        ones from the other end, both in O(1). a borrowed client is checked with a zero timeout poll
+        before it is handed out, a client closed by the server is dropped and the next one is tried.
+        an endpoint has up to max_size() clients, borrow() waits for a returned client up to
+        wait_timeout_ms() when all are borrowed. the clients idle longer than idle_timeout_ms() are
+        closed on the next borrow or return of the endpoint or by evict_idle(), down to min_size().
+        the limits are loaded from NET_CLIENT_POOL_* of the config and can be set before the first borrow.
+        a borrowed client sends with net_client::request(), run() prints every reply to the console.
+        a client whose request failed is closed on its return like an invalidated lease.
+    */
+    class net_client_pool {
+        struct endpoint_t;  // clients of an endpoint, a lease refers to it
+    public:
+        //! a borrowed client, it goes back to the pool when it is destroyed
+        class lease_t {
+        public:
+            lease_t() = default;
+            lease_t(lease_t&& other) noexcept { *this = std::move(other); }
+            lease_t& operator=(lease_t&& other) noexcept;
+            lease_t(const lease_t&) = delete;
+            lease_t& operator=(const lease_t&) = delete;
+            //! destructor, return the client
+            ~lease_t() { release(); }
+
+            net_client* operator->() const { return client_.get(); }
+            net_client& operator*() const { return *client_; }
+            //! is a client borrowed?
+            explicit operator bool() const { return client_ != nullptr; }
+            //! the connection is broken or in an unknown state, it is closed instead of returned
+            void invalidate() { is_valid_ = false; }
+            //! can the client be returned to the pool? not after invalidate() or a failure of the client
+            bool is_valid() const { return client_ != nullptr && is_valid_ && !client_->is_broken(); }
+            //! return the client now
+            void release();
+
+        private:
+            friend class net_client_pool;
+            net_client_pool* pool_ = nullptr;       ///< owner pool
+            endpoint_t* endpoint_ = nullptr;        ///< endpoint of the client in the pool
+            std::unique_ptr<net_client> client_;    ///< borrowed client
+            bool is_valid_ = true;                  ///< can the client be reused?
+        };
+
+        //! constructor, load the limits of the config
+        net_client_pool();
+        //! destructor, close the idle clients, the leases have to be returned before
+        ~net_client_pool();
+        net_client_pool(const net_client_pool&) = delete;
+        net_client_pool& operator=(const net_client_pool&) = delete;
+
+        /*! borrow a connected client of an endpoint, it is thread safe
+            \param ip_address address or "unix:/path", "shm:/path" like net_client::init_socket()
+            \param port_no port
+            \return lease of the client
+            \exception network_error the connect failed
+            \exception pool_exhausted_error no client was returned in wait_timeout_ms()
+        */
+        lease_t borrow(const std::string& ip_address, const std::string& port_no);
+        /*! connect the clients of an endpoint up to min_size(), it is thread safe
+            \param ip_address address like borrow()
+            \param port_no port
+        */
+        void warm_up(const std::string& ip_address, const std::string& port_no);
+        //! close the clients idle longer than idle_timeout_ms() of all the endpoints, it is thread safe
+        void evict_idle();
+        /*! the number of the clients of an endpoint, idle and borrowed
+            \param ip_address address like borrow()
+            \param port_no port
+        */
+        size_t size(const std::string& ip_address, const std::string& port_no);
+        /*! the number of the idle clients of an endpoint
+            \param ip_address address like borrow()
+            \param port_no port
+        */
+        size_t idle_size(const std::string& ip_address, const std::string& port_no);
+
+        //! the number of the clients an endpoint keeps through the eviction
+        size_t min_size() const { return min_size_; }
+        //! set the minimum clients of an endpoint
+        void min_size(size_t size) { min_size_ = size; }
+        //! the maximum clients of an endpoint, 0 is no limit
+        size_t max_size() const { return max_size_; }
+        //! set the maximum clients of an endpoint
+        void max_size(size_t size) { max_size_ = size; }
+        //! milliseconds a client can be idle in the pool, 0 is no limit
+        uint32_t idle_timeout_ms() const { return idle_timeout_ms_; }
+        //! set the idle timeout
+        void idle_timeout_ms(uint32_t timeout) { idle_timeout_ms_ = timeout; }
+        //! milliseconds borrow() waits for a returned client at max_size(), 0 fails at once
+        uint32_t wait_timeout_ms() const { return wait_timeout_ms_; }
+        //! set the wait timeout
+        void wait_timeout_ms(uint32_t timeout) { wait_timeout_ms_ = timeout; }
+
+    private:
+        //! an idle client
+        struct idle_client_t {
+            std::unique_ptr<net_client> client; ///< connected client
+            uint64_t idle_ms;                   ///< time it was returned
+        };
+        //! clients of an endpoint
+        struct endpoint_t {
+            std::string ip_address;             ///< address
+            std::string port_no;                ///< port
+            std::deque<idle_client_t> idle;     ///< idle clients, the most recently used at the back
+            size_t size = 0;                    ///< idle, borrowed and connecting clients
+            std::condition_variable returned;   ///< a client is returned or closed
+        };
+
+        //! find or add an endpoint, the lock has to be held
+        endpoint_t& endpoint_of(const std::string& ip_address, const std::string& port_no);
+        //! find an endpoint, nullptr if it has never been borrowed, the lock has to be held
+        endpoint_t* find_endpoint(const std::string& ip_address, const std::string& port_no);
+        //! connect a new client of an endpoint, its slot is counted in endpoint_t::size already
+        std::unique_ptr<net_client> connect(endpoint_t& endpoint);
+        //! take the stale clients off an endpoint, the lock has to be held
+        void take_stale(endpoint_t& endpoint, uint64_t now_ms, std::vector<std::unique_ptr<net_client>>& stale);
+        //! take back a client of a lease
+        void give_back(endpoint_t& endpoint, std::unique_ptr<net_client> client, bool is_valid);
+
+        std::mutex mutex_;                  ///< lock of the endpoints
+        std::unordered_map<std::string, std::unique_ptr<endpoint_t>> endpoints_;    ///< endpoints by "address:port"
+        size_t min_size_ = 0;               ///< minimum clients of an endpoint
+        size_t max_size_ = 0;               ///< maximum clients of an endpoint
+        uint32_t idle_timeout_ms_ = 0;      ///< idle timeout
+        uint32_t wait_timeout_ms_ = 0;      ///< wait timeout of borrow()
+    }; // class net_client_pool
+} // end coral namespace
+
+#endif // __CORAL_NETCLIENTPOOL_H__
@@ -0,0 +1,801 @@
+/*!
+    \file       net_reactor.cpp
+    \brief      Network event loop of non-blocking connections
+    \details    epoll or io_uring based reactor which multiplexes many connections in a thread
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#include "net_reactor.h"
+#include "log_manager.h"
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+//! global application name
+extern std::string gv_app_name;
+
+namespace {
+    //! make a socket non-blocking
+    void set_nonblocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            throw coral::network_error("fcntl() error");
+        }
+    }
+    //! read size of a receive, same as net_channel_t::fill()
+    const size_t recv_size = 0x10000;
+    //! the number of entries of a submission queue
+    const unsigned int ring_entries = 1024;
+    //! the longest io_uring timeout, a deadline moved earlier meanwhile is late at most by it
+    const int64_t max_ring_timeout_ms = 1000;
+}
+
+coral::net_reactor_t::net_reactor_t(net_reactor_handler_t& handler, bool is_using_io_uring)
+    : handler_(handler), is_stopped_(false), is_draining_(false), connection_size_(0), timers_(timer_tick_ms, steady_ms())
+{
+    if (is_using_io_uring) {
+        try {
+            ring_.reset(new net_uring_t(ring_entries));
+        }
+        catch (coral::exception& error) {
+            coral::log_manager::write(gv_app_name, std::string("net_reactor_t::net_reactor_t():falls back to epoll:") + error.what());
+        }
+    }
+    // io_uring waits on blocking descriptors, a non-blocking one completes with EAGAIN
+    wake_fd_ = eventfd(0, ring_ ? EFD_CLOEXEC : EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        throw coral::network_error("eventfd() error");
+    }
+    if (ring_) {
+        return;
+    }
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        close(wake_fd_);
+        throw coral::network_error("epoll_create1() error");
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+}
+
+coral::net_reactor_t::~net_reactor_t()
+{
+    // the kernel drops the operations in flight before the buffers go away
+    ring_.reset();
+    while (!connections_.empty()) {
+        release_connection(connections_.begin()->first);
+    }
+    for (const auto& client_info : pending_) {
+        close(client_info.socket);
+    }
+    close(wake_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+void coral::net_reactor_t::listen(int fd)
+{
+    if (ring_) {
+        listen_fd_ = fd;
+        return;
+    }
+    set_nonblocking(fd);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+        throw coral::network_error("epoll_ctl() error");
+    }
+    listen_fd_ = fd;
+}
+
+void coral::net_reactor_t::add_connection(const client_info_t& client_info)
+{
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_.push_back(client_info);
+    }
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void coral::net_reactor_t::reply(const net_reply_to_t& reply_to, net_msg_t msg)
+{
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        replies_.push_back(posted_reply_t{reply_to, std::move(msg), true});
+    }
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void coral::net_reactor_t::defer(const net_reply_to_t& reply_to)
+{
+    const auto& pos = connections_.find(reply_to.socket);
+    if (pos != connections_.end() && pos->second->serial == reply_to.serial) {
+        pos->second->deferred_size += reply_to.size;
+    }
+}
+
+void coral::net_reactor_t::release(const net_reply_to_t& reply_to)
+{
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        replies_.push_back(posted_reply_t{reply_to, net_msg_t(), false});
+    }
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void coral::net_reactor_t::stop()
+{
+    is_stopped_ = true;
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void coral::net_reactor_t::drain()
+{
+    // only an atomic and a write, it runs in a signal handler
+    is_draining_ = true;
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void coral::net_reactor_t::run()
+{
+    if (ring_) {
+        run_uring();
+        return;
+    }
+    const int max_events = 256;
+    struct epoll_event events[max_events];
+    now_ms_ = steady_ms();
+    while (!is_stopped_) {
+        int n = epoll_wait(epoll_fd_, events, max_events, static_cast<int>(wait_timeout_ms()));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw coral::network_error("epoll_wait() error");
+        }
+        now_ms_ = steady_ms();
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_) {
+                uint64_t count = 0;
+                ssize_t r = read(wake_fd_, &count, sizeof(count));
+                (void)r;
+                open_pending();
+                send_replies();
+            }
+            else if (fd == listen_fd_) {
+                accept_all();
+            }
+            else {
+                // a connection closed by an earlier event in this batch is gone
+                const auto& pos = connections_.find(fd);
+                if (pos != connections_.end()) {
+                    handle(*pos->second, events[i].events);
+                }
+            }
+        }
+        expire_timers();
+        resume_paused();
+        if (is_draining_ && drain_connections()) {
+            return;
+        }
+    }
+}
+
+int64_t coral::net_reactor_t::wait_timeout_ms() const
+{
+    int64_t timeout = timers_.next_timeout_ms(now_ms_);
+    if (is_accept_paused_ || !paused_.empty()) {
+        timeout = timeout < 0 ? pause_interval_ms : std::min<int64_t>(timeout, pause_interval_ms);
+    }
+    if (is_drain_started_) {
+        int64_t sweep = next_sweep_ms_ > now_ms_ ? static_cast<int64_t>(next_sweep_ms_ - now_ms_) : 0;
+        timeout = timeout < 0 ? sweep : std::min(timeout, sweep);
+    }
+    return timeout;
+}
+
+bool coral::net_reactor_t::drain_connections()
+{
+    if (!is_drain_started_) {
+        is_drain_started_ = true;
+        drain_deadline_ms_ = now_ms_ + drain_timeout_ms_;
+        if (listen_fd_ >= 0) {
+            if (!ring_ && !is_accept_paused_) {
+                epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+            }
+            // an accept in flight of io_uring completes when the server shuts the listener down
+            listen_fd_ = -1;
+            is_accept_paused_ = false;
+        }
+    }
+    else if (now_ms_ < next_sweep_ms_) {
+        return false;
+    }
+    next_sweep_ms_ = now_ms_ + pause_interval_ms;
+    bool is_expired = now_ms_ >= drain_deadline_ms_;
+    std::vector<int> finished;
+    for (const auto& pos : connections_) {
+        const connection_t& conn = *pos.second;
+        if (conn.is_closing) {
+            continue;
+        }
+        // nothing received to handle, nothing deferred and nothing to send
+        if (is_expired || (conn.deferred_size == 0 && conn.sending.empty() && conn.channel.send_buffer().empty()
+                           && conn.channel.recv_buffer().empty())) {
+            finished.push_back(pos.first);
+        }
+    }
+    for (int fd : finished) {
+        close_connection(fd);
+    }
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    return connections_.empty() && pending_.empty();
+}
+
+void coral::net_reactor_t::open_pending()
+{
+    std::vector<client_info_t> pending;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending.swap(pending_);
+    }
+    for (const auto& client_info : pending) {
+        std::unique_ptr<connection_t> conn(new connection_t);
+        conn->client_info = client_info;
+        conn->serial = ++next_serial_;
+        conn->timer.owner = conn.get();
+        conn->active_ms = now_ms_;
+        try {
+            // the replies are written as they are ready, don't let them wait for the acks of the earlier ones
+            int on = 1;
+            setsockopt(client_info.socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            conn->channel.attach(client_info.socket);
+            handler_.on_open(client_info, conn->channel);
+            if (ring_) {
+                connection_t& opened = *conn;
+                connections_[client_info.socket] = std::move(conn);
+                connection_size_.fetch_add(1);
+                submit_recv(opened);
+                touch(opened);
+                continue;
+            }
+            set_nonblocking(client_info.socket);
+            conn->events = EPOLLIN;
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = client_info.socket;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_info.socket, &event) < 0) {
+                throw coral::network_error("epoll_ctl() error");
+            }
+        }
+        catch (coral::exception& error) {
+            coral::log_manager::write(gv_app_name, std::string("net_reactor_t::open_pending():") + error.what());
+            close(client_info.socket);
+            handler_.on_close(client_info);
+            continue;
+        }
+        touch(*conn);
+        connections_[client_info.socket] = std::move(conn);
+        connection_size_.fetch_add(1);
+    }
+}
+
+void coral::net_reactor_t::send_replies()
+{
+    std::vector<posted_reply_t> replies;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        replies.swap(replies_);
+    }
+    for (auto& posted : replies) {
+        const auto& pos = connections_.find(posted.reply_to.socket);
+        if (pos == connections_.end() || pos->second->serial != posted.reply_to.serial || pos->second->is_closing) {
+            continue;
+        }
+        connection_t& conn = *pos->second;
+        conn.deferred_size -= std::min(conn.deferred_size, posted.reply_to.size);
+        if (!posted.has_reply || posted.reply_to.is_batched) {
+            continue;
+        }
+        try {
+            conn.channel.encode(posted.msg, posted.reply_to.request_id);
+            if (ring_) {
+                submit_send(conn);
+            }
+            else if (!send(conn)) {
+                close_connection(posted.reply_to.socket);
+            }
+        }
+        catch (coral::exception& error) {
+            coral::log_manager::write(gv_app_name, std::string("net_reactor_t::send_replies():") + error.what());
+            close_connection(posted.reply_to.socket);
+        }
+    }
+}
+
+void coral::net_reactor_t::accept_all()
+{
+    // the listener is being shut down
+    if (is_draining_) {
+        return;
+    }
+    while (true) {
+        if (!handler_.can_accept()) {
+            pause_accept();
+            return;
+        }
+        client_info_t client_info = {};
+        socklen_t client_address_size = sizeof(client_info.address);
+        client_info.socket = accept4(listen_fd_, (struct sockaddr*)&client_info.address, &client_address_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_info.socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                pause_accept_on_error(errno);
+            }
+            return;
+        }
+        accept_retry_ms_ = 0;
+        handler_.on_accept(*this, client_info);
+    }
+}
+
+void coral::net_reactor_t::handle(connection_t& conn, uint32_t events)
+{
+    int fd = conn.client_info.socket;
+    try {
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            ssize_t n = conn.channel.fill();
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_connection(fd);
+                return;
+            }
+            dispatch(conn);
+            touch(conn);
+        }
+        if (!send(conn)) {
+            close_connection(fd);
+        }
+    }
+    catch (coral::exception& error) {
+        coral::log_manager::write(gv_app_name, std::string("net_reactor_t::handle():") + error.what());
+        close_connection(fd);
+    }
+    catch (std::exception& error) {
+        coral::log_manager::write(gv_app_name, std::string("net_reactor_t::handle():") + error.what());
+        close_connection(fd);
+    }
+}
+
+void coral::net_reactor_t::dispatch(connection_t& conn)
+{
+    net_msg_t msg;
+    net_reply_to_t reply_to;
+    reply_to.reactor = this;
+    reply_to.socket = conn.client_info.socket;
+    reply_to.serial = conn.serial;
+    while (true) {
+        // the rest stays in the receive buffer until the connection is resumed
+        if (is_over_budget(conn)) {
+            pause(conn);
+            return;
+        }
+        size_t size = conn.channel.recv_buffer().size();
+        if (!conn.channel.decode(msg, reply_to.request_id)) {
+            return;
+        }
+        reply_to.size = size - conn.channel.recv_buffer().size();
+        reply_to.is_batched = conn.channel.is_batched();
+        conn.active_ms = now_ms_;
+        conn.partial_ms = 0;
+        if (handler_.on_message(conn.client_info, msg, reply_to) && !reply_to.is_batched) {
+            conn.channel.encode(msg, reply_to.request_id);
+        }
+    }
+}
+
+void coral::net_reactor_t::touch(connection_t& conn)
+{
+    if (idle_timeout_ms_ == 0 && read_timeout_ms_ == 0) {
+        return;
+    }
+    // the bytes left after dispatch() are a message in progress, unless the connection is paused
+    if (conn.channel.recv_buffer().empty()) {
+        conn.partial_ms = 0;
+    }
+    else if (conn.partial_ms == 0) {
+        conn.partial_ms = now_ms_;
+    }
+    uint64_t deadline = UINT64_MAX;
+    if (idle_timeout_ms_ > 0) {
+        deadline = conn.active_ms + idle_timeout_ms_;
+    }
+    if (read_timeout_ms_ > 0 && conn.partial_ms > 0) {
+        deadline = std::min<uint64_t>(deadline, conn.partial_ms + read_timeout_ms_);
+    }
+    if (deadline == UINT64_MAX) {
+        timers_.cancel(conn.timer);
+    }
+    else {
+        timers_.schedule(conn.timer, deadline);
+    }
+}
+
+void coral::net_reactor_t::expire_timers()
+{
+    timers_.advance(now_ms_, [this](timer_wheel::entry_t& timer) {
+        connection_t& conn = *static_cast<connection_t*>(timer.owner);
+        if (conn.is_closing) {
+            return;
+        }
+        // it is waiting for its replies or for the handler, start over from now
+        if (conn.is_paused || conn.deferred_size > 0 || !conn.sending.empty() || !conn.channel.send_buffer().empty()) {
+            conn.active_ms = now_ms_;
+            conn.partial_ms = 0;
+            touch(conn);
+            return;
+        }
+        handler_.on_timeout(conn.client_info);
+        close_connection(conn.client_info.socket);
+    });
+}
+
+bool coral::net_reactor_t::is_over_budget(const connection_t& conn)
+{
+    if (max_connection_bytes_ > 0) {
+        size_t size = conn.channel.send_buffer().size() + conn.sending.size() + conn.deferred_size;
+        if (size > max_connection_bytes_) {
+            return true;
+        }
+    }
+    return !handler_.can_dispatch();
+}
+
+void coral::net_reactor_t::pause(connection_t& conn)
+{
+    if (conn.is_paused) {
+        return;
+    }
+    conn.is_paused = true;
+    paused_.push_back(conn.client_info.socket);
+    handler_.on_pause(conn.client_info);
+}
+
+void coral::net_reactor_t::pause_accept()
+{
+    if (is_accept_paused_) {
+        return;
+    }
+    is_accept_paused_ = true;
+    if (!ring_) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+    }
+}
+
+void coral::net_reactor_t::pause_accept_on_error(int error)
+{
+    // out of descriptors and so on, an accept at once would fail again
+    bool is_first = accept_retry_ms_ == 0;
+    accept_retry_ms_ = now_ms_ + pause_interval_ms;
+    pause_accept();
+    if (!is_first) return;
+    try {
+        coral::log_manager::write(gv_app_name, std::string("net_reactor_t::pause_accept_on_error():accept error:") + std::strerror(error));
+    }
+    catch (const std::exception&) {
+        // the log can't be opened while the descriptors are out
+    }
+}
+
+void coral::net_reactor_t::resume_paused()
+{
+    if (is_accept_paused_ && !is_draining_ && now_ms_ >= accept_retry_ms_ && handler_.can_accept()) {
+        is_accept_paused_ = false;
+        if (ring_) {
+            next_sqe(URING_ACCEPT, listen_fd_);
+        }
+        else {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = listen_fd_;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+        }
+    }
+    if (paused_.empty()) {
+        return;
+    }
+    std::vector<int> paused;
+    paused.swap(paused_);
+    for (int fd : paused) {
+        const auto& pos = connections_.find(fd);
+        if (pos == connections_.end()) {
+            continue;
+        }
+        connection_t& conn = *pos->second;
+        if (conn.is_closing || is_over_budget(conn)) {
+            paused_.push_back(fd);
+            continue;
+        }
+        conn.is_paused = false;
+        try {
+            // the messages left in the receive buffer first, it may pause again
+            dispatch(conn);
+            touch(conn);
+            if (ring_) {
+                if (!conn.is_paused && !conn.is_receiving) {
+                    submit_recv(conn);
+                }
+                submit_send(conn);
+            }
+            else if (!send(conn)) {
+                close_connection(fd);
+            }
+        }
+        catch (coral::exception& error) {
+            coral::log_manager::write(gv_app_name, std::string("net_reactor_t::resume_paused():") + error.what());
+            close_connection(fd);
+        }
+    }
+}
+
+bool coral::net_reactor_t::send(connection_t& conn)
+{
+    if (!conn.channel.send_buffer().empty() && conn.channel.drain() < 0) {
+        return false;
+    }
+    // watch EPOLLOUT only while the socket doesn't take the whole send buffer
+    uint32_t events = 0;
+    if (!conn.is_paused) events |= EPOLLIN;
+    if (!conn.channel.send_buffer().empty()) events |= EPOLLOUT;
+    if (events != conn.events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.fd = conn.client_info.socket;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.client_info.socket, &event) < 0) {
+            return false;
+        }
+        conn.events = events;
+    }
+    return true;
+}
+
+void coral::net_reactor_t::close_connection(int fd)
+{
+    const auto& pos = connections_.find(fd);
+    if (pos == connections_.end()) {
+        return;
+    }
+    if (ring_) {
+        connection_t& conn = *pos->second;
+        conn.is_closing = true;
+        timers_.cancel(conn.timer);
+        // the socket is closed after the operations in flight, so its number isn't reused under them
+        if (conn.is_receiving || conn.is_sending) {
+            shutdown(fd, SHUT_RDWR);
+            return;
+        }
+    }
+    else {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    release_connection(fd);
+}
+
+void coral::net_reactor_t::release_connection(int fd)
+{
+    const auto& pos = connections_.find(fd);
+    if (pos == connections_.end()) {
+        return;
+    }
+    std::unique_ptr<connection_t> conn = std::move(pos->second);
+    connections_.erase(pos);
+    timers_.cancel(conn->timer);
+    connection_size_.fetch_sub(1);
+    close(fd);
+    handler_.on_close(conn->client_info);
+}
+
+void coral::net_reactor_t::run_uring()
+{
+    next_sqe(URING_WAKE, wake_fd_);
+    if (listen_fd_ >= 0) {
+        next_sqe(URING_ACCEPT, listen_fd_);
+    }
+    now_ms_ = steady_ms();
+    while (!is_stopped_) {
+        int64_t timeout = wait_timeout_ms();
+        if (timeout >= 0 && !is_timer_armed_) {
+            // it completes on the timeout or on any other completion, whichever comes first
+            timeout = std::min(timeout, max_ring_timeout_ms);
+            timeout_.tv_sec = timeout / 1000;
+            timeout_.tv_nsec = (timeout % 1000) * 1000000L;
+            struct io_uring_sqe* sqe = next_sqe(URING_TIMEOUT, -1);
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->addr = reinterpret_cast<uint64_t>(&timeout_);
+            sqe->len = 1;
+            is_timer_armed_ = true;
+        }
+        // submit everything queued by the last completions and wait for the next one
+        if (ring_->submit(1) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            throw coral::network_error(std::string("io_uring_enter() error:") + std::strerror(errno));
+        }
+        now_ms_ = steady_ms();
+        ring_->for_each_cqe([this](uint64_t user_data, int res) { complete(user_data, res); });
+        expire_timers();
+        resume_paused();
+        if (is_draining_ && drain_connections()) {
+            return;
+        }
+    }
+}
+
+struct io_uring_sqe* coral::net_reactor_t::next_sqe(uring_op_t op, int fd)
+{
+    struct io_uring_sqe* sqe = ring_->get_sqe();
+    while (sqe == nullptr) {
+        if (ring_->submit() < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            throw coral::network_error(std::string("io_uring_enter() error:") + std::strerror(errno));
+        }
+        sqe = ring_->get_sqe();
+    }
+    sqe->fd = fd;
+    sqe->user_data = static_cast<uint64_t>(op) << 32 | static_cast<uint32_t>(fd);
+    switch (op) {
+    case URING_WAKE:
+        sqe->opcode = IORING_OP_READ;
+        sqe->addr = reinterpret_cast<uint64_t>(&wake_count_);
+        sqe->len = sizeof(wake_count_);
+        break;
+    case URING_ACCEPT:
+        // a unix domain client leaves the address empty
+        memset(&accept_address_, 0, sizeof(accept_address_));
+        accept_address_size_ = sizeof(accept_address_);
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->addr = reinterpret_cast<uint64_t>(&accept_address_);
+        sqe->addr2 = reinterpret_cast<uint64_t>(&accept_address_size_);
+        sqe->accept_flags = SOCK_CLOEXEC;
+        break;
+    default:
+        break;
+    }
+    return sqe;
+}
+
+void coral::net_reactor_t::submit_recv(connection_t& conn)
+{
+    struct io_uring_sqe* sqe = next_sqe(URING_RECV, conn.client_info.socket);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->addr = reinterpret_cast<uint64_t>(conn.channel.recv_buffer().prepare(recv_size));
+    sqe->len = recv_size;
+    conn.is_receiving = true;
+}
+
+void coral::net_reactor_t::submit_send(connection_t& conn)
+{
+    if (conn.is_sending || conn.is_closing) {
+        return;
+    }
+    if (conn.sending.empty()) {
+        if (conn.channel.send_buffer().empty()) {
+            return;
+        }
+        // the channel keeps encoding into the other buffer while this one is in flight
+        std::swap(conn.sending, conn.channel.send_buffer());
+    }
+    struct io_uring_sqe* sqe = next_sqe(URING_SEND, conn.client_info.socket);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = reinterpret_cast<uint64_t>(conn.sending.data());
+    sqe->len = static_cast<uint32_t>(std::min<size_t>(conn.sending.size(), UINT32_MAX));
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn.is_sending = true;
+}
+
+void coral::net_reactor_t::complete(uint64_t user_data, int res)
+{
+    uring_op_t op = static_cast<uring_op_t>(user_data >> 32);
+    int fd = static_cast<int>(user_data & 0xffffffff);
+    if (op == URING_WAKE) {
+        open_pending();
+        send_replies();
+        next_sqe(URING_WAKE, wake_fd_);
+        return;
+    }
+    if (op == URING_TIMEOUT) {
+        is_timer_armed_ = false;
+        return;
+    }
+    if (op == URING_ACCEPT) {
+        if (is_draining_) {
+            // the listener is being shut down, don't accept again
+            if (res >= 0) {
+                client_info_t client_info;
+                client_info.socket = res;
+                client_info.address = accept_address_;
+                handler_.on_accept(*this, client_info);
+            }
+            return;
+        }
+        if (res >= 0) {
+            client_info_t client_info;
+            client_info.socket = res;
+            client_info.address = accept_address_;
+            accept_retry_ms_ = 0;
+            handler_.on_accept(*this, client_info);
+        }
+        else if (res != -EINTR && res != -EAGAIN && res != -ECONNABORTED) {
+            pause_accept_on_error(-res);
+            return;
+        }
+        // an accept in flight can't be taken back, so the limit can be passed by one
+        if (handler_.can_accept()) {
+            next_sqe(URING_ACCEPT, listen_fd_);
+        }
+        else {
+            pause_accept();
+        }
+        return;
+    }
+
+    const auto& pos = connections_.find(fd);
+    if (pos == connections_.end()) {
+        return;
+    }
+    connection_t& conn = *pos->second;
+    if (op == URING_RECV) {
+        conn.is_receiving = false;
+    }
+    else {
+        conn.is_sending = false;
+    }
+    if (conn.is_closing) {
+        if (!conn.is_receiving && !conn.is_sending) {
+            release_connection(fd);
+        }
+        return;
+    }
+    try {
+        if (res == -EINTR || res == -EAGAIN) {
+            if (op == URING_RECV) submit_recv(conn);
+            else submit_send(conn);
+            return;
+        }
+        // a send isn't submitted empty, a send of 0 bytes makes no progress either
+        if (res <= 0) {
+            close_connection(fd);
+            return;
+        }
+        if (op == URING_RECV) {
+            conn.channel.recv_buffer().commit(res);
+            dispatch(conn);
+            touch(conn);
+            if (!conn.is_paused) {
+                submit_recv(conn);
+            }
+        }
+        else {
+            conn.sending.consume(res);
+        }
+        submit_send(conn);
+    }
+    catch (coral::exception& error) {
+        coral::log_manager::write(gv_app_name, std::string("net_reactor_t::complete():") + error.what());
+        close_connection(fd);
+    }
+    catch (std::exception& error) {
+        coral::log_manager::write(gv_app_name, std::string("net_reactor_t::complete():") + error.what());
+        close_connection(fd);
+    }
+}
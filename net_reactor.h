@@ -0,0 +1,260 @@
+/*!
+    \file       net_reactor.h
+    \brief      Network event loop of non-blocking connections
+    \details    epoll or io_uring based reactor which multiplexes many connections in a thread
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#ifndef __CORAL_NETREACTOR_H__
+#define __CORAL_NETREACTOR_H__
+
+#include "net_channel.h"
+#include "net_uring.h"
+#include "timer_wheel.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    class net_reactor_t;
+
+    //! the connection and the request of a message, a reply can be sent later with net_reactor_t::reply()
+    struct net_reply_to_t {
+        net_reactor_t* reactor = nullptr;   ///< reactor of the connection
+        int socket = -1;                    ///< socket of the connection
+        uint64_t serial = 0;                ///< serial number of the connection, a socket number can be reused
+        uint32_t request_id = 0;            ///< request id of the message
+        size_t size = 0;                    ///< size of the message on the wire
+        bool is_batched = false;            ///< the message came in a batch, its reply is dropped
+    };
+
+    //! events of a reactor, a server implements it
+    class net_reactor_handler_t {
+    public:
+        virtual ~net_reactor_handler_t() = default;
+        /*! a listener of a reactor accepted a connection, hand it to a reactor with add_connection()
+            \param reactor the reactor which accepted the connection
+            \param client_info the client, the socket is non-blocking with epoll
+        */
+        virtual void on_accept(net_reactor_t& reactor, const client_info_t& client_info) = 0;
+        //! a connection is opened in a reactor, set up the protocol of the channel
+        virtual void on_open(const client_info_t& client_info, net_channel_t& channel) = 0;
+        /*! a whole message is received
+            \param client_info the client
+            \param msg the message, it is sent back as the reply if true is returned
+            \param reply_to the connection and the request, to reply later from another thread
+            \return true to reply msg, false to reply later or not to reply
+        */
+        virtual bool on_message(const client_info_t& client_info, net_msg_t& msg, const net_reply_to_t& reply_to) = 0;
+        //! a connection is closed
+        virtual void on_close(const client_info_t& client_info) = 0;
+        //! can a connection be accepted now? a reactor stops accepting and asks again a little later if not
+        virtual bool can_accept() { return true; }
+        //! can a message be handled now? a reactor stops reading and asks again a little later if not
+        virtual bool can_dispatch() { return true; }
+        //! the reads of a connection are paused
+        virtual void on_pause(const client_info_t& client_info) {}
+        //! a connection passed its idle or read deadline, it is closed and on_close() follows
+        virtual void on_timeout(const client_info_t& client_info) {}
+    };
+
+    //! epoll or io_uring event loop of non-blocking connections
+    /*!
+        a reactor owns its connections and runs in one thread, a server runs a few reactors
+        and hands each accepted connection to one of them. a message is handled in the reactor
+        thread as soon as it is received whole, so a handler must not block for long.
+        the sockets are level triggered and a connection reads at most 64KB at a time,
+        so a busy connection doesn't starve the others.
+        with io_uring the accepts, receives and sends are submitted and completed in batches,
+        one io_uring_enter call per loop instead of an epoll_wait and a read and a write per event.
+        a connection has a receive in flight all the time and a send while there are replies,
+        the replies encoded during a send are sent after it.
+        a connection stops reading while its unsent replies and deferred requests are over
+        max_connection_bytes() or the handler can't dispatch, the listener stops accepting while
+        the handler can't accept. a paused reactor checks them again every pause_interval_ms.
+        a connection is closed when no message arrives in idle_timeout_ms() or a started message
+        isn't completed in read_timeout_ms(). the deadlines are in a timer wheel of the reactor,
+        a receive moves the timer of its connection in O(1) and the loop wakes up only for the ticks
+        which have timers. a connection waiting for its own replies isn't idle.
+        drain() stops accepting and closes each connection as soon as it has no request in flight,
+        run() returns when all are closed or at drain_timeout_ms() after closing the rest.
+    */
+    class net_reactor_t {
+    public:
+        /*! constructor
+            \param handler events handler, it has to live longer than the reactor
+            \param is_using_io_uring use io_uring, it falls back to epoll if io_uring isn't available
+        */
+        explicit net_reactor_t(net_reactor_handler_t& handler, bool is_using_io_uring = false);
+        //! destructor, close the connections
+        ~net_reactor_t();
+        net_reactor_t(const net_reactor_t&) = delete;
+        net_reactor_t& operator=(const net_reactor_t&) = delete;
+
+        /*! accept connections of a listening socket in this reactor, it has to be called before run()
+            \param fd a listening socket, it is made non-blocking with epoll
+        */
+        void listen(int fd);
+        /*! add a connection, it is thread safe
+            \param client_info the client, the socket is made non-blocking with epoll
+        */
+        void add_connection(const client_info_t& client_info);
+        //! event loop, it returns after stop()
+        void run();
+        //! stop the event loop, it is thread safe
+        void stop();
+        //! stop accepting, close the connections after their requests and return from run(), it is async signal safe
+        void drain();
+        /*! send a reply of a message later, it is thread safe
+            \param reply_to the connection and the request from on_message(), it is dropped if the connection is closed
+            \param msg the reply
+        */
+        void reply(const net_reply_to_t& reply_to, net_msg_t msg);
+        //! the number of the connections
+        int connection_size() const { return connection_size_; }
+        //! is io_uring used?
+        bool is_using_io_uring() const { return ring_ != nullptr; }
+        /*! defer the reply of a message in on_message(), the reply or release has to follow
+            \param reply_to the connection and the request from on_message()
+        */
+        void defer(const net_reply_to_t& reply_to);
+        /*! finish a deferred message without a reply, it is thread safe
+            \param reply_to the connection and the request from on_message()
+        */
+        void release(const net_reply_to_t& reply_to);
+        //! the maximum bytes of the unsent replies and the deferred requests of a connection, 0 is no limit
+        size_t max_connection_bytes() const { return max_connection_bytes_; }
+        //! set the maximum bytes of a connection before run()
+        void max_connection_bytes(size_t size) { max_connection_bytes_ = size; }
+        //! milliseconds a connection can be without a message, 0 is no limit
+        uint32_t idle_timeout_ms() const { return idle_timeout_ms_; }
+        //! set the idle timeout before run()
+        void idle_timeout_ms(uint32_t timeout) { idle_timeout_ms_ = timeout; }
+        //! milliseconds a started message can take to be received whole, 0 is no limit
+        uint32_t read_timeout_ms() const { return read_timeout_ms_; }
+        //! set the read timeout before run()
+        void read_timeout_ms(uint32_t timeout) { read_timeout_ms_ = timeout; }
+        //! milliseconds drain() waits for the requests in flight
+        uint32_t drain_timeout_ms() const { return drain_timeout_ms_; }
+        //! set the drain timeout before run()
+        void drain_timeout_ms(uint32_t timeout) { drain_timeout_ms_ = timeout; }
+
+        //! interval to check the paused connections and the listener again
+        static constexpr int pause_interval_ms = 10;
+        //! resolution of the deadlines
+        static constexpr uint32_t timer_tick_ms = 10;
+
+    private:
+        //! a connection of a reactor
+        struct connection_t {
+            client_info_t client_info;  ///< the client
+            uint64_t serial = 0;        ///< serial number of the connection
+            net_channel_t channel;      ///< message channel
+            uint32_t events = 0;        ///< registered epoll events
+            size_t deferred_size = 0;   ///< bytes of the deferred requests
+            bool is_paused = false;     ///< is reading paused?
+            net_buffer_t sending;       ///< io_uring, bytes of the send in flight
+            bool is_receiving = false;  ///< io_uring, is a receive in flight?
+            bool is_sending = false;    ///< io_uring, is a send in flight?
+            bool is_closing = false;    ///< io_uring, it is closed after the operations in flight complete
+            timer_wheel::entry_t timer; ///< idle or read deadline
+            uint64_t active_ms = 0;     ///< time of the last message
+            uint64_t partial_ms = 0;    ///< time a message started to be received, 0 if none
+        };
+        //! io_uring operations, the upper 32 bits of user_data
+        enum uring_op_t : uint32_t { URING_WAKE = 1, URING_ACCEPT, URING_RECV, URING_SEND, URING_TIMEOUT };
+
+        //! a reply from reply() or release()
+        struct posted_reply_t {
+            net_reply_to_t reply_to;    ///< destination
+            net_msg_t msg;              ///< reply
+            bool has_reply;             ///< false if it is from release()
+        };
+
+        //! open the connections added by add_connection()
+        void open_pending();
+        //! send the replies from reply()
+        void send_replies();
+        //! accept the connections of the listener
+        void accept_all();
+        //! read, handle messages and write
+        void handle(connection_t& conn, uint32_t events);
+        //! decode the received messages and encode the replies
+        void dispatch(connection_t& conn);
+        //! move the deadline of a connection after a receive
+        void touch(connection_t& conn);
+        //! close the connections over their deadlines
+        void expire_timers();
+        /*! close the connections without requests in flight, or all of them after the drain timeout
+            \return true if no connection is left
+        */
+        bool drain_connections();
+        //! milliseconds to wait for the events, -1 is infinite
+        int64_t wait_timeout_ms() const;
+        //! write the send buffer, watch EPOLLOUT while it isn't empty and EPOLLIN unless paused
+        bool send(connection_t& conn);
+        //! is a connection over its budget?
+        bool is_over_budget(const connection_t& conn);
+        //! pause the reads of a connection
+        void pause(connection_t& conn);
+        //! resume the paused connections and the listener which are below the limits
+        void resume_paused();
+        //! stop accepting
+        void pause_accept();
+        /*! stop accepting for pause_interval_ms after an accept error like EMFILE, the listener stays readable meanwhile.
+            only the first error of a row is logged
+            \param error errno of the accept
+        */
+        void pause_accept_on_error(int error);
+        //! close a connection, with io_uring it is released after the operations in flight
+        void close_connection(int fd);
+        //! remove a connection and close the socket
+        void release_connection(int fd);
+        //! io_uring event loop
+        void run_uring();
+        //! handle an io_uring completion
+        void complete(uint64_t user_data, int res);
+        //! get a submission entry, submit the queue if it is full
+        struct io_uring_sqe* next_sqe(uring_op_t op, int fd);
+        //! submit a receive into the receive buffer of the channel
+        void submit_recv(connection_t& conn);
+        //! start a send of the encoded replies unless one is in flight
+        void submit_send(connection_t& conn);
+
+        net_reactor_handler_t& handler_;    ///< events handler
+        int epoll_fd_ = -1;                 ///< epoll
+        int wake_fd_ = -1;                  ///< eventfd to wake the event loop
+        int listen_fd_ = -1;                ///< listening socket, -1 if this reactor doesn't accept
+        std::atomic<bool> is_stopped_;      ///< stop flag
+        std::atomic<bool> is_draining_;     ///< drain flag
+        std::atomic<int> connection_size_;  ///< the number of the connections
+        timer_wheel timers_;                ///< deadlines of the connections
+        std::unordered_map<int, std::unique_ptr<connection_t>> connections_;   ///< connections by socket
+        std::mutex pending_mutex_;                  ///< lock of pending_
+        std::vector<client_info_t> pending_;        ///< connections to be opened
+        std::vector<posted_reply_t> replies_;       ///< replies from reply(), guarded by pending_mutex_
+        uint64_t next_serial_ = 0;                  ///< serial number of the next connection
+        size_t max_connection_bytes_ = 0;           ///< the maximum in flight bytes of a connection
+        uint32_t idle_timeout_ms_ = 0;              ///< idle timeout of a connection
+        uint32_t read_timeout_ms_ = 0;              ///< read timeout of a message
+        uint64_t now_ms_ = 0;                       ///< time of the current loop
+        uint32_t drain_timeout_ms_ = 0;             ///< drain timeout
+        bool is_drain_started_ = false;             ///< is the listener gone and the drain deadline set?
+        uint64_t drain_deadline_ms_ = 0;            ///< the connections left are closed after it
+        uint64_t next_sweep_ms_ = 0;                ///< time to look for the finished connections again
+        std::vector<int> paused_;                   ///< paused connections
+        bool is_accept_paused_ = false;             ///< is the listener paused?
+        uint64_t accept_retry_ms_ = 0;              ///< a listener paused on an accept error isn't resumed before it, 0 after an accept
+        bool is_timer_armed_ = false;               ///< io_uring, is a timeout in flight?
+        struct __kernel_timespec timeout_;          ///< io_uring, the timeout in flight
+        std::unique_ptr<net_uring_t> ring_;         ///< io_uring, nullptr with epoll
+        struct sockaddr_in accept_address_;         ///< io_uring, address of the accept in flight
+        socklen_t accept_address_size_ = 0;         ///< io_uring, size of accept_address_
+        uint64_t wake_count_ = 0;                   ///< io_uring, counter of the read of wake_fd_ in flight
+    }; // class net_reactor_t
+} // end coral namespace
+
+#endif // __CORAL_NETREACTOR_H__
@@ -0,0 +1,125 @@
+/*!
+    \file       net_schema.h
+    \brief      Compile-time schema of network message structs
+    \details    encode and decode a fixed layout struct in the net_msg_t wire format without a map
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+#ifndef __CORAL_NET_SCHEMA_H__
+#define __CORAL_NET_SCHEMA_H__
+
+#include "types.h"
+#include <tuple>
+#include <utility>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! a field of a message struct, a key and a pointer to the member
+    template <class T, typename M>
+    struct net_field_t {
+        using struct_type = T;      ///< message struct
+        using member_type = M;      ///< member type, a type which has net_value_type
+        const char* key;            ///< key on the wire
+        M T::* member;              ///< pointer to the member
+    };
+    //! make a field of a message struct
+    template <class T, typename M>
+    constexpr net_field_t<T, M> make_net_field(const char* key, M T::* member) { return {key, member}; }
+
+    //! field list of a message struct, CORAL_NET_SCHEMA specializes it with a tuple of net_field_t
+    template <class T> struct net_schema;
+
+    //! call f(field, index) for each field of a schema in order
+    template <class Fields, class F, size_t... I>
+    inline void net_for_each_field(const Fields& fields, F&& f, std::index_sequence<I...>) {
+        int expand[] = {0, (f(std::get<I>(fields), I), 0)...};
+        (void)expand;
+    }
+
+    //! message type of a fixed layout struct
+    /*!
+        the fields of T are listed in net_schema<T> at compile time, so a message is written
+        field by field in the schema order without hashing or a map allocation. the wire format
+        is the same as net_msg_t, a peer can use net_msg_t or net_variant_msg_t for the same command.
+        decoding takes the fields in the schema order first and looks up a moved field by key,
+        unknown fields are ignored and a missing field throws domain_error.
+        it works with net_channel_t like net_msg_t.
+
+        struct quote_t { int code; double price; std::string name; };
+        CORAL_NET_SCHEMA(quote_t, CORAL_NET_FIELD(quote_t, code), CORAL_NET_FIELD(quote_t, price), CORAL_NET_FIELD(quote_t, name))
+        coral::net_struct_msg_t<quote_t> msg;
+    */
+    template <class T>
+    class net_struct_msg_t {
+    public:
+        using struct_type = T;
+        using fields_type = decltype(net_schema<T>::fields());
+        static constexpr int field_size = std::tuple_size<fields_type>::value;  ///< the number of fields
+
+        int cmd = -1;   ///< command code
+        T data{};       ///< message struct
+
+        //! the number of fields
+        int size() const { return field_size; }
+        /*! serialize at the end of the buffer, see net_msg_t::encode()
+            \param buffer buffer
+            \param keys key dictionary for sending, nullptr if the keys are sent as strings
+        */
+        void encode(net_buffer_t& buffer, net_key_dictionary_t* keys = nullptr) const {
+            net_encode_header(buffer, cmd, field_size);
+            net_for_each_field(net_schema<T>::fields(), [this, &buffer, keys](const auto& field, size_t) {
+                net_encode_field(buffer, field.key, data.*field.member, keys);
+            }, std::make_index_sequence<field_size>());
+        }
+        /*! deserialize from bytes, see net_msg_t::decode()
+            \return false if the bytes don't have a whole message yet
+        */
+        bool decode(const char* bytes, size_t size, size_t& used, net_key_dictionary_t* keys = nullptr) {
+            if (!view_.parse(bytes, size, used, keys)) {
+                return false;
+            }
+            net_for_each_field(net_schema<T>::fields(), [this](const auto& field, size_t index) {
+                // a sender of the same schema keeps the order
+                const auto& fields = view_.fields();
+                const net_msg_view_t::field_t* value = index < fields.size() && fields[index].key == field.key
+                                                     ? &fields[index] : view_.find(field.key);
+                if (value == nullptr) {
+                    throw coral::domain_error(std::string("There is no ") + field.key + " in the message.");
+                }
+                net_msg_view_t::get_value(*value, data.*field.member);
+            }, std::make_index_sequence<field_size>());
+            cmd = view_.cmd;
+            return true;
+        }
+        /*! write to a file using one write call
+            \param fd a descriptor of a file
+            \param buffer reusable buffer
+            \return written size, -1 if an error occurred
+        */
+        int write_to_network(int fd, net_buffer_t& buffer) const {
+            buffer.clear();
+            encode(buffer);
+            return net_write_all(fd, buffer.data(), buffer.size());
+        }
+        //! clear
+        void clear() { cmd = 0; data = T(); }
+        //! clear data, net_channel_t calls it on EOF
+        void clear_data_container() { data = T(); }
+
+    private:
+        net_msg_view_t view_;   ///< parsed fields, its capacity is reused
+    }; // class net_struct_msg_t
+} // end coral namespace
+
+//! a field of a message struct for CORAL_NET_SCHEMA, the member name is the key
+#define CORAL_NET_FIELD(type, member) coral::make_net_field(#member, &type::member)
+//! schema of a message struct, use it in the global namespace
+#define CORAL_NET_SCHEMA(type, ...) \
+    namespace coral { \
+        template <> struct net_schema<type> { \
+            static constexpr auto fields() { return std::make_tuple(__VA_ARGS__); } \
+        }; \
+    }
+
+#endif // __CORAL_NET_SCHEMA_H__
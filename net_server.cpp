@@ -8,22 +8,38 @@
 */
 
 #include "net_server.h"
+#include "net_channel.h"
+#include "net_shm.h"
 #include "log_manager.h"
 #include "thread_pool.h"
+#include <signal.h>
+#include <sys/stat.h>
 
 //! global application name
 extern std::string gv_app_name;
 
+std::atomic<coral::net_server*> coral::net_server::signaled_server_{nullptr};
+
 coral::net_server::net_server() {
     CORAL_D_CLASS_MEMBER_FUNC_START;
     server_socket_ = 0;
     client_count_ = 0;
+    next_reactor_ = 0;
     CORAL_D_CLASS_MEMBER_FUNC_END;
 }
 
 coral::net_server::~net_server() {
     CORAL_D_CLASS_MEMBER_FUNC_START;
     if (server_socket_ > 0) close(server_socket_);
+    for (size_t i = 1; i < listeners_.size(); i++) {
+        close(listeners_[i]);
+    }
+    if (!unix_path_.empty() && unix_path_[0] != '@') {
+        unlink(unix_path_.c_str());
+    }
+    for (auto& client_thread : client_threads_) {
+        client_thread->thread.join();
+    }
     CORAL_D_CLASS_MEMBER_FUNC_END;
 }
 
@@ -34,38 +50,107 @@ int coral::net_server::init_socket(const std::string& ip_address, const std::str
     std::ostringstream method_info;
     method_info << CORAL_D_METHOD_INFO << "(" << ip_address << ',' << port_no << "):";
 
-    server_socket_= socket(PF_INET, SOCK_STREAM, 0);
+    // a reactor of the sharded mode has its own listening socket on the same port, TCP only
+    std::string unix_path = net_unix_path(ip_address);
+    is_shm_ = false;
+    if (unix_path.empty()) {
+        unix_path = net_shm_path(ip_address);
+        is_shm_ = !unix_path.empty();
+    }
+    bool is_sharded = coral::config::instance()->get_value("NET_SERVER_USING_REACTOR") == "TRUE"
+                   && coral::config::instance()->get_value("NET_SERVER_USING_REUSEPORT") == "TRUE"
+                   && unix_path.empty();
+    int listener_size = is_sharded ? reactor_size() : 1;
+    for (int i = 0; i < listener_size; i++) {
+        int listener = unix_path.empty() ? open_listener(port_no, is_sharded, method_info.str())
+                                         : open_unix_listener(unix_path, method_info.str());
+        if (listener < 0) {
+            for (int fd : listeners_) close(fd);
+            listeners_.clear();
+            server_socket_ = 0;
+            CORAL_D_CLASS_MEMBER_FUNC_END;
+            return -1;
+        }
+        listeners_.push_back(listener);
+    }
+    server_socket_ = listeners_[0];
+    unix_path_ = unix_path;
+
+    std::ostringstream oss;
+    oss << "ServerSocket=" << server_socket_ << ",Listeners=" << listeners_.size();
+    log_manager::write(gv_app_name, method_info.str() + oss.str());
+    CORAL_D_CLASS_MEMBER_FUNC_END;
+    return server_socket_;
+}
 
-    if (server_socket_ <= 0) {
-        log_manager::write(gv_app_name, method_info.str() + "socket() error");
+int coral::net_server::open_listener(const std::string& port_no, bool is_reuseport, const std::string& method_info)
+{
+    int listener = socket(PF_INET, SOCK_STREAM, 0);
+
+    if (listener <= 0) {
+        log_manager::write(gv_app_name, method_info + "socket() error");
         return -1;
     }
 
+    if (is_reuseport) {
+        int on = 1;
+        if (setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            log_manager::write(gv_app_name, method_info + "setsockopt(SO_REUSEPORT) error");
+            close(listener);
+            return -1;
+        }
+    }
+
     memset(&server_address_, 0, sizeof(server_address_));
     server_address_.sin_family = AF_INET;
     server_address_.sin_addr.s_addr = htonl(INADDR_ANY);
     server_address_.sin_port = htons(atoi(port_no.c_str()));
 
     socklen_t server_address_size_ = sizeof(server_address_);
-    if (bind(server_socket_, (struct sockaddr*)&server_address_, server_address_size_) < 0) {
-        log_manager::write(gv_app_name, method_info.str() + "bind() error");
-        close(server_socket_);
-        CORAL_D_CLASS_MEMBER_FUNC_END;
+    if (bind(listener, (struct sockaddr*)&server_address_, server_address_size_) < 0) {
+        log_manager::write(gv_app_name, method_info + "bind() error");
+        close(listener);
         return -1;
     }
 
-    if (listen(server_socket_, std::stoi(coral::config::instance()->get_value("NET_SERVER_LISTENER"))) < 0) {
-        log_manager::write(gv_app_name, method_info.str() + "listen() error");
-        close(server_socket_);
-        CORAL_D_CLASS_MEMBER_FUNC_END;
+    if (listen(listener, std::stoi(coral::config::instance()->get_value("NET_SERVER_LISTENER"))) < 0) {
+        log_manager::write(gv_app_name, method_info + "listen() error");
+        close(listener);
         return -1;
     }
+    return listener;
+}
 
-    std::ostringstream oss;
-    oss << "ServerSocket=" << server_socket_;
-    log_manager::write(gv_app_name, method_info.str() + oss.str());
-    CORAL_D_CLASS_MEMBER_FUNC_END;
-    return server_socket_;
+int coral::net_server::open_unix_listener(const std::string& path, const std::string& method_info)
+{
+    struct sockaddr_un address;
+    socklen_t address_size = net_unix_address(path, address);
+    if (address_size == 0) {
+        log_manager::write(gv_app_name, method_info + "unix socket path error");
+        return -1;
+    }
+    // a socket file left by a server which didn't exit cleanly
+    struct stat file_stat;
+    if (path[0] != '@' && stat(path.c_str(), &file_stat) == 0 && S_ISSOCK(file_stat.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        log_manager::write(gv_app_name, method_info + "socket() error");
+        return -1;
+    }
+    if (bind(listener, (struct sockaddr*)&address, address_size) < 0) {
+        log_manager::write(gv_app_name, method_info + "bind() error:" + std::strerror(errno));
+        close(listener);
+        return -1;
+    }
+    if (listen(listener, std::stoi(coral::config::instance()->get_value("NET_SERVER_LISTENER"))) < 0) {
+        log_manager::write(gv_app_name, method_info + "listen() error");
+        close(listener);
+        return -1;
+    }
+    return listener;
 }
 
 void coral::net_server::run() {
@@ -75,11 +160,34 @@ void coral::net_server::run() {
     std::ostringstream method_info;
     method_info << CORAL_D_METHOD_INFO << "():";
     try {
+        load_limits();
+        if (coral::config::instance()->get_value("NET_SERVER_USING_REACTOR") == "TRUE") {
+            if (!is_shm_) {
+                run_reactor();
+                CORAL_D_CLASS_MEMBER_FUNC_END;
+                return;
+            }
+            // a thread sleeps on the futex of its client, a reactor can't wait on it
+            coral::log_manager::write(gv_app_name, method_info.str() + "shared memory clients are served in threads");
+        }
         coral::thread_pool tp(std::stoi(coral::config::instance()->get_value("NET_SERVER_THREAD_POOL")));
         bool is_using_thread_pool = coral::config::instance()->get_value("NET_SERVER_USING_THREAD_POOL") == "TRUE" ? true : false;
+        int max_thread_size = atoi(coral::config::instance()->get_value("NET_SERVER_MAX_THREADS").c_str());
+        if (max_thread_size <= 0) {
+            max_thread_size = std::stoi(coral::config::instance()->get_value("NET_SERVER_THREAD_POOL"));
+        }
 
-        while (true) {
-            coral::client_info_t client_info;
+        while (!is_stopping_) {
+            if (!is_using_thread_pool) {
+                // the clients beyond the limit wait in the listen queue
+                join_threads(max_thread_size, true);
+            }
+            // the clients over NET_SERVER_MAX_CONNECTIONS wait in the listen queue
+            while (!can_accept() && !is_stopping_) {
+                usleep(net_reactor_t::pause_interval_ms * 1000);
+            }
+            // a unix domain client leaves the address empty
+            coral::client_info_t client_info = {};
             int client_address_size = sizeof(client_info.address);
             // accept
 #ifdef __linux__
@@ -88,20 +196,46 @@ void coral::net_server::run() {
             client_info.socket = accept(server_socket_, (struct sockaddr*)&client_info.address, &client_address_size);
 #endif
             if (client_info.socket < 0) {
+                // stop() shuts the listener down
+                if (is_stopping_) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
                 throw coral::network_error("accept() error.");
             }
+            if (!admit(client_info)) {
+                continue;
+            }
             client_count_.fetch_add(1);
             coral::print_string(log_message, 64, "to be connected client count:%d", static_cast<int>(client_count_));
             coral::log_manager::write(gv_app_name, method_info.str() + log_message);
+            {
+                std::lock_guard<std::mutex> lock(socket_mutex_);
+                client_sockets_.insert(client_info.socket);
+            }
 
             if (is_using_thread_pool) {
-                auto f = tp.enqueue_job(std::bind(&coral::net_server::thread_method, this, std::placeholders::_1), client_info);
+                auto f = tp.enqueue_job([this, client_info] {
+                    try {
+                        thread_method(client_info);
+                    }
+                    catch (...) {
+                        coral::log_manager::write(gv_app_name, std::string("net_server::run():") + CORAL_D_STRMSG(EN, ERR, 000010));
+                    }
+                });
             }
             else {
-                auto f = std::async(std::launch::async, &coral::net_server::thread_method, this, client_info);
+                start_thread(client_info);
             }
             //usleep(1000);// wait 1mm sec
         }
+        coral::log_manager::write(gv_app_name, method_info.str() + "stopping, draining the clients");
+        drain_clients();
+        if (!is_using_thread_pool) {
+            join_threads(1);
+        }
     }
     catch (coral::exception& error) {
         coral::log_manager::write(gv_app_name, method_info.str()+error.what());
@@ -121,6 +255,51 @@ void coral::net_server::run() {
     CORAL_D_CLASS_MEMBER_FUNC_END;
 }
 
+template <class Channel>
+void coral::net_server::serve_channel(Channel& channel, const coral::client_info_t& client_info, const std::string& method_info)
+{
+    net_msg_t net_msg;
+    uint32_t request_id = 0;
+    while(true) {
+        if (channel.read_msg(net_msg, request_id) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            timed_out_count_.fetch_add(1);
+            coral::log_manager::write(gv_app_name, method_info + "timed out");
+            break;
+        }
+        if (net_msg.cmd == -1) {
+            break;
+        }
+        coral::thread_pool* pool = executor_of(net_msg.cmd);
+        if (pool != nullptr) {
+            // the replies keep the order of the requests on a connection
+            queued_requests_.fetch_add(1);
+            auto is_reply = pool->enqueue_job([this, &client_info, &net_msg] { return process_message(client_info, net_msg); });
+            bool is_replied = false;
+            try {
+                is_replied = is_reply.get();
+            }
+            catch (...) {
+                queued_requests_.fetch_sub(1);
+                throw;
+            }
+            queued_requests_.fetch_sub(1);
+            if (!is_replied) {
+                continue;
+            }
+        }
+        else if (!process_message(client_info, net_msg)) {
+            continue;
+        }
+        // a message of a batch is one-way
+        if (channel.is_batched()) {
+            continue;
+        }
+        if (channel.write_msg(net_msg, request_id) < 0) {
+            break;
+        }
+    };
+}
+
 void coral::net_server::thread_method(const coral::client_info_t& client_info)
 {
     coral::elapsed_time et;
@@ -128,16 +307,27 @@ void coral::net_server::thread_method(const coral::client_info_t& client_info)
     method_info << CORAL_D_FUNCTION_INFO << "(" << client_info.socket << ',' << inet_ntoa(client_info.address.sin_addr) << "):";
     std::string log_message;
     try {
-        net_msg_t net_msg;
-        while(true) {
-            net_msg.read_from_network(client_info.socket);
-            if (net_msg.cmd == -1) {
-                break;
+        // a blocking read can't be woken by a timer, the channel times out by itself
+        uint32_t timeout_ms = idle_timeout_ms_ > 0 ? idle_timeout_ms_ : read_timeout_ms_;
+        if (is_shm_) {
+            net_shm_channel_t channel;
+            setup_channel(channel.codec());
+            channel.accept(client_info.socket, protocol_features());
+            channel.busy_poll_us(atoi(coral::config::instance()->get_value("NET_SERVER_SHM_BUSY_POLL_US").c_str()));
+            channel.read_timeout_ms(timeout_ms);
+            serve_channel(channel, client_info, method_info.str());
+        }
+        else {
+            net_channel_t channel(client_info.socket);
+            setup_channel(channel);
+            if (timeout_ms > 0) {
+                struct timeval timeout;
+                timeout.tv_sec = timeout_ms / 1000;
+                timeout.tv_usec = (timeout_ms % 1000) * 1000;
+                setsockopt(client_info.socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
             }
-            std::cout << "[CLIENT MSG]:" << net_msg << '\n';
-            net_msg.write_to_network(client_info.socket);
-            coral::log_manager::write(gv_app_name, net_msg.to_string());
-        };
+            serve_channel(channel, client_info, method_info.str());
+        }
     }
     catch (coral::exception& error) {
         coral::log_manager::write(gv_app_name, method_info.str()+error.what());
@@ -150,9 +340,436 @@ void coral::net_server::thread_method(const coral::client_info_t& client_info)
     }
 
     //    ݴ´.
+    forget_client(client_info.socket);
     close(client_info.socket);
     client_count_.fetch_sub(1); // decrease client count
 
     coral::print_string(log_message, gv_string_msg_size, "%s:ElapsedTime:%.6lfs", CORAL_D_STRMSG(EN, STR, 000004), et.sec());
     coral::log_manager::write(gv_app_name, method_info.str() + log_message);
 }
+
+void coral::net_server::register_handler(int cmd, net_handler_t handler, NET_HANDLER_EXECUTOR executor, size_t thread_size)
+{
+    handler_entry_t entry;
+    entry.handler = std::move(handler);
+    if (executor == NET_HANDLER_SHARED_POOL) {
+        if (!shared_pool_) {
+            int shared_size = atoi(coral::config::instance()->get_value("NET_SERVER_HANDLER_THREADS").c_str());
+            shared_pool_ = std::make_shared<coral::thread_pool>(shared_size > 0 ? shared_size : 4);
+        }
+        entry.pool = shared_pool_;
+    }
+    else if (executor == NET_HANDLER_DEDICATED_POOL) {
+        entry.pool = std::make_shared<coral::thread_pool>(std::max<size_t>(thread_size, 1));
+    }
+    handlers_[cmd] = std::move(entry);
+}
+
+coral::thread_pool* coral::net_server::executor_of(int cmd) const
+{
+    const auto& pos = handlers_.find(cmd);
+    return pos == handlers_.end() ? nullptr : pos->second.pool.get();
+}
+
+bool coral::net_server::process_message(const coral::client_info_t& client_info, net_msg_t& msg)
+{
+    const auto& pos = handlers_.find(msg.cmd);
+    if (pos != handlers_.end()) {
+        return pos->second.handler(client_info, msg);
+    }
+    std::cout << "[CLIENT MSG]:" << msg << '\n';
+    coral::log_manager::write(gv_app_name, msg.to_string());
+    return true;
+}
+
+void coral::net_server::setup_channel(net_channel_t& channel)
+{
+    int features = protocol_features();
+    if (features == NET_PROTOCOL_FEATURE_NONE) {
+        return;
+    }
+    int threshold = atoi(coral::config::instance()->get_value("NET_SERVER_COMPRESSION_THRESHOLD").c_str());
+    if (threshold > 0) {
+        channel.compression_threshold(threshold);
+    }
+    channel.accept_protocol(features);
+}
+
+int coral::net_server::protocol_features()
+{
+    if (coral::config::instance()->get_value("NET_SERVER_USING_FRAME") != "TRUE") {
+        return NET_PROTOCOL_FEATURE_NONE;
+    }
+    int features = NET_PROTOCOL_FEATURE_FRAME;
+    if (coral::config::instance()->get_value("NET_SERVER_USING_KEY_DICTIONARY") == "TRUE") {
+        features |= NET_PROTOCOL_FEATURE_KEY_DICTIONARY;
+    }
+    if (coral::config::instance()->get_value("NET_SERVER_USING_COMPRESSION") == "TRUE") {
+        features |= NET_PROTOCOL_FEATURE_COMPRESSION;
+    }
+    if (coral::config::instance()->get_value("NET_SERVER_USING_BATCH") == "TRUE") {
+        features |= NET_PROTOCOL_FEATURE_BATCH;
+    }
+    return features;
+}
+
+int coral::net_server::reactor_size()
+{
+    int size = atoi(coral::config::instance()->get_value("NET_SERVER_REACTOR_THREADS").c_str());
+    if (size <= 0) {
+        size = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return size;
+}
+
+void coral::net_server::run_reactor()
+{
+    std::ostringstream method_info;
+    method_info << CORAL_D_METHOD_INFO << "():";
+    // the sharded mode has a reactor per listener, each one accepts its own clients
+    bool is_sharded = listeners_.size() > 1;
+    int size = is_sharded ? static_cast<int>(listeners_.size()) : reactor_size();
+    bool is_using_io_uring = coral::config::instance()->get_value("NET_SERVER_USING_IO_URING") == "TRUE";
+    size_t max_connection_bytes = strtoul(coral::config::instance()->get_value("NET_SERVER_MAX_CONNECTION_BYTES").c_str(), nullptr, 10);
+    is_reactor_ready_ = false;
+    reactors_.clear();
+    for (int i = 0; i < size; i++) {
+        reactors_.emplace_back(new net_reactor_t(*this, is_using_io_uring));
+        reactors_[i]->max_connection_bytes(max_connection_bytes);
+        reactors_[i]->idle_timeout_ms(idle_timeout_ms_);
+        reactors_[i]->read_timeout_ms(read_timeout_ms_);
+        reactors_[i]->drain_timeout_ms(drain_timeout_ms_);
+        if (is_sharded) {
+            reactors_[i]->listen(listeners_[i]);
+        }
+    }
+    if (!is_sharded) {
+        reactors_[0]->listen(server_socket_);
+    }
+    is_reactor_ready_ = true;
+    // stop() came before the reactors
+    if (is_stopping_) {
+        for (auto& reactor : reactors_) reactor->drain();
+    }
+    coral::log_manager::write(gv_app_name, method_info.str() + "reactor threads:" + std::to_string(size) + (is_sharded ? ",sharded" : "")
+                              + (reactors_[0]->is_using_io_uring() ? ",io_uring" : ",epoll"));
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < reactors_.size(); i++) {
+        threads.emplace_back([this, i, is_sharded, &method_info] {
+            if (is_sharded) {
+                pin_thread(i, method_info.str());
+            }
+            try {
+                reactors_[i]->run();
+            }
+            catch (coral::exception& error) {
+                coral::log_manager::write(gv_app_name, method_info.str() + error.what());
+            }
+        });
+    }
+    try {
+        if (is_sharded) {
+            pin_thread(0, method_info.str());
+        }
+        reactors_[0]->run();
+    }
+    catch (...) {
+        for (auto& reactor : reactors_) reactor->stop();
+        for (auto& thread : threads) thread.join();
+        throw;
+    }
+    // the first reactor is drained, the others finish their drains
+    for (auto& reactor : reactors_) reactor->drain();
+    for (auto& thread : threads) thread.join();
+    coral::log_manager::write(gv_app_name, method_info.str() + "stopped, clients:" + std::to_string(client_count_));
+}
+
+void coral::net_server::pin_thread(size_t index, const std::string& method_info)
+{
+#ifdef __linux__
+    unsigned int core_size = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(index % core_size, &cpu_set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (error != 0) {
+        coral::log_manager::write(gv_app_name, method_info + "pthread_setaffinity_np() error:" + std::strerror(error));
+    }
+#endif
+}
+
+void coral::net_server::on_accept(net_reactor_t& reactor, const coral::client_info_t& client_info)
+{
+    std::ostringstream method_info;
+    method_info << CORAL_D_METHOD_INFO << "(" << client_info.socket << ',' << inet_ntoa(client_info.address.sin_addr) << "):";
+    std::string log_message;
+    if (!admit(client_info)) {
+        return;
+    }
+    client_count_.fetch_add(1);
+    coral::print_string(log_message, 64, "to be connected client count:%d", static_cast<int>(client_count_));
+    coral::log_manager::write(gv_app_name, method_info.str() + log_message);
+    if (listeners_.size() > 1) {
+        reactor.add_connection(client_info);
+    }
+    else {
+        reactors_[next_reactor_.fetch_add(1) % reactors_.size()]->add_connection(client_info);
+    }
+}
+
+void coral::net_server::on_open(const coral::client_info_t& client_info, net_channel_t& channel)
+{
+    setup_channel(channel);
+}
+
+bool coral::net_server::on_message(const coral::client_info_t& client_info, net_msg_t& msg, const net_reply_to_t& reply_to)
+{
+    coral::thread_pool* pool = executor_of(msg.cmd);
+    if (pool == nullptr) {
+        return process_message(client_info, msg);
+    }
+    // the reactor goes on with the other messages and the reply is posted back to it
+    auto request = std::make_shared<net_msg_t>(std::move(msg));
+    queued_requests_.fetch_add(1);
+    reply_to.reactor->defer(reply_to);
+    pool->enqueue_job([this, client_info, request, reply_to] {
+        // the queued request and the deferred reply are given back on every path out of the job
+        struct deferred_t {
+            std::atomic<int>& queued_requests;
+            const net_reply_to_t& reply_to;
+            bool is_replied;
+            ~deferred_t() {
+                queued_requests.fetch_sub(1);
+                if (!is_replied) {
+                    reply_to.reactor->release(reply_to);
+                }
+            }
+        } deferred{queued_requests_, reply_to, false};
+        bool is_reply = false;
+        try {
+            is_reply = process_message(client_info, *request);
+        }
+        catch (coral::exception& error) {
+            coral::log_manager::write(gv_app_name, std::string("net_server::on_message():") + error.what());
+        }
+        catch (std::exception& error) {
+            coral::log_manager::write(gv_app_name, std::string("net_server::on_message():") + error.what());
+        }
+        catch (...) {
+            coral::log_manager::write(gv_app_name, std::string("net_server::on_message():") + CORAL_D_STRMSG(EN, ERR, 000010));
+        }
+        if (is_reply) {
+            reply_to.reactor->reply(reply_to, std::move(*request));
+            deferred.is_replied = true;
+        }
+    });
+    return false;
+}
+
+void coral::net_server::on_close(const coral::client_info_t& client_info)
+{
+    std::ostringstream method_info;
+    method_info << CORAL_D_METHOD_INFO << "(" << client_info.socket << ',' << inet_ntoa(client_info.address.sin_addr) << "):";
+    std::string log_message;
+    client_count_.fetch_sub(1);
+    coral::print_string(log_message, 64, "disconnected, client count:%d", static_cast<int>(client_count_));
+    coral::log_manager::write(gv_app_name, method_info.str() + log_message);
+}
+
+void coral::net_server::start_thread(const coral::client_info_t& client_info)
+{
+    std::unique_ptr<client_thread_t> client_thread(new client_thread_t);
+    client_thread_t* self = client_thread.get();
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        alive_thread_size_++;
+    }
+    try {
+        client_thread->thread = std::thread([this, self, client_info] {
+            try {
+                thread_method(client_info);
+            }
+            catch (...) {
+                coral::log_manager::write(gv_app_name, std::string("net_server::start_thread():") + CORAL_D_STRMSG(EN, ERR, 000010));
+            }
+            std::lock_guard<std::mutex> lock(thread_mutex_);
+            self->is_finished = true;
+            alive_thread_size_--;
+            thread_cond_.notify_one();
+        });
+    }
+    catch (std::system_error& error) {
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex_);
+            alive_thread_size_--;
+        }
+        forget_client(client_info.socket);
+        close(client_info.socket);
+        client_count_.fetch_sub(1);
+        coral::log_manager::write(gv_app_name, std::string("net_server::start_thread():") + error.what());
+        return;
+    }
+    client_threads_.push_back(std::move(client_thread));
+}
+
+void coral::net_server::join_threads(size_t max_thread_size, bool is_stoppable)
+{
+    std::list<std::unique_ptr<client_thread_t>> finished_threads;
+    {
+        std::unique_lock<std::mutex> lock(thread_mutex_);
+        // stop() runs in a signal handler and can't notify, is_stopping_ is checked every pause
+        while (!thread_cond_.wait_for(lock, std::chrono::milliseconds(net_reactor_t::pause_interval_ms),
+            [this, max_thread_size, is_stoppable] { return alive_thread_size_ < max_thread_size || (is_stoppable && is_stopping_); })) {
+        }
+        for (auto pos = client_threads_.begin(); pos != client_threads_.end();) {
+            if ((*pos)->is_finished) {
+                finished_threads.splice(finished_threads.end(), client_threads_, pos++);
+            }
+            else {
+                ++pos;
+            }
+        }
+    }
+    // a finished thread is returning, so the join doesn't wait long
+    for (auto& client_thread : finished_threads) {
+        client_thread->thread.join();
+    }
+}
+
+void coral::net_server::forget_client(int socket)
+{
+    std::lock_guard<std::mutex> lock(socket_mutex_);
+    const auto& pos = client_sockets_.find(socket);
+    if (pos != client_sockets_.end()) {
+        client_sockets_.erase(pos);
+    }
+}
+
+void coral::net_server::drain_clients()
+{
+    coral::elapsed_time et;
+    {
+        // a thread answers the requests already received, then its read ends
+        std::lock_guard<std::mutex> lock(socket_mutex_);
+        for (int socket : client_sockets_) {
+            shutdown(socket, SHUT_RD);
+        }
+    }
+    while (et.sec() * 1000 < drain_timeout_ms_) {
+        {
+            std::lock_guard<std::mutex> lock(socket_mutex_);
+            if (client_sockets_.empty()) {
+                return;
+            }
+        }
+        usleep(net_reactor_t::pause_interval_ms * 1000);
+    }
+    // the writes blocked on slow clients fail too
+    std::lock_guard<std::mutex> lock(socket_mutex_);
+    for (int socket : client_sockets_) {
+        shutdown(socket, SHUT_RDWR);
+    }
+}
+
+void coral::net_server::stop()
+{
+    // only atomics and system calls, it runs in a signal handler
+    if (is_stopping_.exchange(true)) {
+        return;
+    }
+    if (is_reactor_ready_) {
+        for (auto& reactor : reactors_) {
+            reactor->drain();
+        }
+    }
+    // a blocking accept or an accept of io_uring in flight returns
+    for (int listener : listeners_) {
+        shutdown(listener, SHUT_RD);
+    }
+}
+
+void coral::net_server::stop_on_signal(int signal_no)
+{
+    signaled_server_ = this;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &net_server::on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(signal_no, &action, nullptr) < 0) {
+        throw coral::domain_error(std::string("sigaction() error:") + std::strerror(errno));
+    }
+}
+
+void coral::net_server::on_signal(int signal_no)
+{
+    int saved_errno = errno;
+    net_server* server = signaled_server_;
+    if (server != nullptr) {
+        server->stop();
+    }
+    errno = saved_errno;
+}
+
+void coral::net_server::load_limits()
+{
+    max_connections_ = atoi(coral::config::instance()->get_value("NET_SERVER_MAX_CONNECTIONS").c_str());
+    max_queued_requests_ = atoi(coral::config::instance()->get_value("NET_SERVER_MAX_QUEUED_REQUESTS").c_str());
+    is_rejecting_ = coral::config::instance()->get_value("NET_SERVER_OVERLOAD_POLICY") == "REJECT";
+    drain_timeout_ms_ = strtoul(coral::config::instance()->get_value("NET_SERVER_DRAIN_TIMEOUT_MS").c_str(), nullptr, 10);
+    idle_timeout_ms_ = strtoul(coral::config::instance()->get_value("NET_SERVER_IDLE_TIMEOUT_MS").c_str(), nullptr, 10);
+    read_timeout_ms_ = strtoul(coral::config::instance()->get_value("NET_SERVER_READ_TIMEOUT_MS").c_str(), nullptr, 10);
+}
+
+bool coral::net_server::admit(const coral::client_info_t& client_info)
+{
+    // with DEFER the accepts wait in can_accept(), an accept which was in flight is let in
+    if (is_rejecting_ && max_connections_ > 0 && client_count_ >= max_connections_) {
+        close(client_info.socket);
+        rejected_count_.fetch_add(1);
+        return false;
+    }
+    accepted_count_.fetch_add(1);
+    return true;
+}
+
+bool coral::net_server::can_accept()
+{
+    if (is_rejecting_ || max_connections_ <= 0 || client_count_ < max_connections_) {
+        is_deferring_ = false;
+        return true;
+    }
+    if (!is_deferring_.exchange(true)) {
+        deferred_count_.fetch_add(1);
+    }
+    return false;
+}
+
+bool coral::net_server::can_dispatch()
+{
+    return max_queued_requests_ <= 0 || queued_requests_ < max_queued_requests_;
+}
+
+void coral::net_server::on_pause(const coral::client_info_t& client_info)
+{
+    paused_count_.fetch_add(1);
+}
+
+void coral::net_server::on_timeout(const coral::client_info_t& client_info)
+{
+    timed_out_count_.fetch_add(1);
+}
+
+coral::net_server_metrics_t coral::net_server::metrics() const
+{
+    net_server_metrics_t metrics;
+    metrics.connections = client_count_;
+    metrics.queued_requests = queued_requests_;
+    metrics.accepted = accepted_count_;
+    metrics.rejected = rejected_count_;
+    metrics.deferred = deferred_count_;
+    metrics.paused = paused_count_;
+    metrics.timed_out = timed_out_count_;
+    return metrics;
+}
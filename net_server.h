@@ -11,34 +11,216 @@
 #define __CORAL_NETSERVER_H__
 
 #include "utility.h"
+#include "net_reactor.h"
+#include "thread_pool.h"
+#include <condition_variable>
+#include <list>
+#include <unordered_set>
 
 //! Core Library for Applications and Libraries
 namespace coral {
+    //! where a command handler runs
+    enum NET_HANDLER_EXECUTOR {
+        NET_HANDLER_INLINE = 0,         ///< in the thread which received the message, a reactor thread in the reactor mode
+        NET_HANDLER_SHARED_POOL,        ///< in the pool shared by the commands, NET_SERVER_HANDLER_THREADS threads
+        NET_HANDLER_DEDICATED_POOL      ///< in a pool of the command only
+    };
+    //! handler of a command, it returns true to reply the message which it modified
+    using net_handler_t = std::function<bool(const coral::client_info_t& client_info, net_msg_t& msg)>;
+
+    //! admission counters of a server
+    struct net_server_metrics_t {
+        int connections = 0;        ///< the number of the connected clients
+        int queued_requests = 0;    ///< the number of the requests in the handler pools
+        uint64_t accepted = 0;      ///< accepted clients
+        uint64_t rejected = 0;      ///< clients closed at once over NET_SERVER_MAX_CONNECTIONS
+        uint64_t deferred = 0;      ///< times the accepts were deferred over NET_SERVER_MAX_CONNECTIONS
+        uint64_t paused = 0;        ///< times the reads of a connection were paused, the reactor mode
+        uint64_t timed_out = 0;     ///< clients closed over NET_SERVER_IDLE_TIMEOUT_MS or NET_SERVER_READ_TIMEOUT_MS
+    };
+
     //! network server class
     /*!
         net_server Class  base interface class ϰ
         deriveϴ class run() thread_method() overrideϿ Ͽ Ѵ.
+        a message is handled by process_message() in both modes, the thread mode gives each client
+        a thread and the reactor mode(NET_SERVER_USING_REACTOR=TRUE) multiplexes the clients in
+        a few reactor threads.
     */
-    class net_server {
+    class net_server : protected net_reactor_handler_t {
     public:
         //! default construct in protected area.
         net_server();
         //! default desturct
         virtual ~net_server();
-        //! server socket initialize
+        /*! server socket initialize
+            \param ip_address "unix:/path" listens on a unix domain socket for the clients on the same host,
+            "shm:/path" too and a client there offers a shared memory segment which carries the messages
+            \param port_no port, empty with a unix domain socket
+        */
         int init_socket(const std::string& ip_address, const std::string& port_no);
-        //! virtual member method - server run
+        /*! virtual member method - server run, it returns after stop().
+            without the thread pool a client gets its own thread, at most NET_SERVER_MAX_THREADS threads
+            are alive and the accept loop waits for one to finish beyond that. a client thread closes
+            its client without a message in NET_SERVER_IDLE_TIMEOUT_MS with SO_RCVTIMEO.
+            each shared memory client has its own thread in any mode
+        */
         virtual void run();
+        /*! register a handler of a command, it has to be called before run().
+            a slow command in a pool doesn't hold the reactor threads or the pool of the cheap commands
+            \param cmd command code
+            \param handler handler, the default process_message() calls it
+            \param executor where the handler runs
+            \param thread_size the number of threads of a dedicated pool
+        */
+        void register_handler(int cmd, net_handler_t handler, NET_HANDLER_EXECUTOR executor = NET_HANDLER_INLINE, size_t thread_size = 1);
+        //! admission counters, it is thread safe
+        net_server_metrics_t metrics() const;
+        /*! stop the server gracefully, it is async signal safe.
+            the server stops accepting, lets the requests in flight finish up to NET_SERVER_DRAIN_TIMEOUT_MS,
+            closes the clients and joins the threads, then run() returns
+        */
+        void stop();
+        /*! call stop() on a signal like SIGTERM, the last server which asked for a signal gets it
+            \param signal_no signal number
+        */
+        void stop_on_signal(int signal_no);
 
     protected:
-        //! active method, it'll be overrided by derived class
+        /*! active method, it'll be overrided by derived class
+            it closes the socket of the client after forget_client(), an accept can reuse the number once it is closed
+        */
         virtual void thread_method(const coral::client_info_t& client_info);
+        //! a client is done, drain_clients() doesn't shut its socket down any more
+        void forget_client(int socket);
+        /*! handle a message of a client, it'll be overrided by derived class, the default calls
+            the handler of the command and echoes the message without a handler
+            \param client_info the client
+            \param msg the message, it is sent back to the client as the reply if true is returned
+            \return true to reply msg
+        */
+        virtual bool process_message(const coral::client_info_t& client_info, net_msg_t& msg);
+        //! set up the protocol of a channel of a client
+        void setup_channel(net_channel_t& channel);
+        //! NET_PROTOCOL_FEATURE flags which the server supports
+        static int protocol_features();
+        /*! open a listening socket
+            \param port_no port
+            \param is_reuseport set SO_REUSEPORT for the sharded listeners
+            \param method_info prefix of the log messages
+            \return the socket, -1 if an error occurred
+        */
+        int open_listener(const std::string& port_no, bool is_reuseport, const std::string& method_info);
+        /*! open a listening unix domain socket, a stale socket file of the path is removed
+            \param path path from net_unix_path()
+            \param method_info prefix of the log messages
+            \return the socket, -1 if an error occurred
+        */
+        int open_unix_listener(const std::string& path, const std::string& method_info);
+        //! the number of the reactors, NET_SERVER_REACTOR_THREADS or the number of cores
+        static int reactor_size();
+        /*! run the reactors, the first one runs in this thread and accepts the clients unless the listeners are sharded.
+            with NET_SERVER_USING_REUSEPORT=TRUE each reactor accepts on its own SO_REUSEPORT listener in
+            a core pinned thread, NET_SERVER_USING_IO_URING=TRUE runs them on io_uring when the kernel has it.
+            a reactor closes a client which doesn't complete a started message in NET_SERVER_READ_TIMEOUT_MS
+            or is idle NET_SERVER_IDLE_TIMEOUT_MS with its timer wheel
+        */
+        void run_reactor();
+        //! pin the calling thread to a core, index is wrapped around the number of cores
+        static void pin_thread(size_t index, const std::string& method_info);
+        //! net_reactor_handler_t, hand an accepted client to a reactor by turns, or to the accepting reactor if sharded
+        void on_accept(net_reactor_t& reactor, const coral::client_info_t& client_info) override;
+        //! net_reactor_handler_t, set up the protocol of a client
+        void on_open(const coral::client_info_t& client_info, net_channel_t& channel) override;
+        /*! read the admission limits from the config.
+            over NET_SERVER_MAX_CONNECTIONS the new clients wait in the listen queue or are closed by
+            NET_SERVER_OVERLOAD_POLICY. a reactor stops reading a connection over NET_SERVER_MAX_CONNECTION_BYTES
+            and all its connections over NET_SERVER_MAX_QUEUED_REQUESTS
+        */
+        void load_limits();
+        //! count an accepted client in, or close it if it is over the limit with REJECT
+        bool admit(const coral::client_info_t& client_info);
+        //! net_reactor_handler_t, false while the new clients are deferred
+        bool can_accept() override;
+        //! net_reactor_handler_t, false while the handler pools are full
+        bool can_dispatch() override;
+        //! net_reactor_handler_t, count the pause
+        void on_pause(const coral::client_info_t& client_info) override;
+        //! net_reactor_handler_t, count the timeout
+        void on_timeout(const coral::client_info_t& client_info) override;
+        //! pool of a command, nullptr if it runs inline
+        coral::thread_pool* executor_of(int cmd) const;
+        //! net_reactor_handler_t, process_message() inline or in the pool of the command
+        bool on_message(const coral::client_info_t& client_info, net_msg_t& msg, const net_reply_to_t& reply_to) override;
+        //! net_reactor_handler_t, count the client down
+        void on_close(const coral::client_info_t& client_info) override;
+        /*! start a thread of a client without the thread pool
+            \param client_info the client, the socket is closed if a thread can't be started
+        */
+        void start_thread(const coral::client_info_t& client_info);
+        /*! wait while max_thread_size threads of the clients are alive and join the finished ones
+            \param max_thread_size the maximum number of alive threads
+            \param is_stoppable stop waiting when stop() is called
+        */
+        void join_threads(size_t max_thread_size, bool is_stoppable = false);
+        //! the thread mode, end the reads of the clients and close them after NET_SERVER_DRAIN_TIMEOUT_MS
+        void drain_clients();
         // Member variables
         //sockets
         int server_socket_; ///< the socket of a server
         struct sockaddr_in server_address_;        ///< address struct of a server
         //! atomic the number of the client count
         std::atomic<int> client_count_;
+        std::vector<std::unique_ptr<net_reactor_t>> reactors_;  ///< reactors of the reactor mode
+        std::atomic<size_t> next_reactor_;      ///< reactor of the next accepted client
+        std::vector<int> listeners_;            ///< listening sockets, the first one is server_socket_
+        std::string unix_path_;                 ///< path of the unix domain socket, empty with TCP
+        bool is_shm_ = false;                   ///< are the clients on shared memory?
+
+    private:
+        //! a thread of a client without the thread pool
+        struct client_thread_t {
+            std::thread thread;         ///< thread running thread_method()
+            bool is_finished = false;   ///< is thread_method() returned? guarded by thread_mutex_
+        };
+        std::list<std::unique_ptr<client_thread_t>> client_threads_;  ///< threads of the clients, only the accept loop touches the list
+        size_t alive_thread_size_ = 0;          ///< the number of the running threads, guarded by thread_mutex_
+        std::mutex thread_mutex_;               ///< lock of the thread states
+        std::condition_variable thread_cond_;   ///< signaled when a thread finishes
+        std::mutex socket_mutex_;                       ///< lock of client_sockets_
+        std::unordered_multiset<int> client_sockets_;   ///< sockets of the client threads, drain_clients() ends them
+        /*! read, handle and answer the messages of a client until it leaves
+            \param channel net_channel_t or net_shm_channel_t of the client
+            \param client_info the client
+            \param method_info prefix of the log messages
+        */
+        template <class Channel>
+        void serve_channel(Channel& channel, const coral::client_info_t& client_info, const std::string& method_info);
+        //! signal handler of stop_on_signal()
+        static void on_signal(int signal_no);
+        static std::atomic<net_server*> signaled_server_;  ///< server of on_signal()
+        std::atomic<bool> is_stopping_{false};          ///< is stop() called?
+        std::atomic<bool> is_reactor_ready_{false};     ///< are reactors_ built? stop() drains them then
+        uint32_t drain_timeout_ms_ = 0;         ///< NET_SERVER_DRAIN_TIMEOUT_MS
+        //! a registered handler
+        struct handler_entry_t {
+            net_handler_t handler;                      ///< handler
+            std::shared_ptr<coral::thread_pool> pool;   ///< executor, nullptr if inline
+        };
+        std::unordered_map<int, handler_entry_t> handlers_;    ///< handlers by command
+        std::shared_ptr<coral::thread_pool> shared_pool_;      ///< pool shared by the commands, it is created on demand
+        int max_connections_ = 0;               ///< NET_SERVER_MAX_CONNECTIONS
+        int max_queued_requests_ = 0;           ///< NET_SERVER_MAX_QUEUED_REQUESTS
+        bool is_rejecting_ = false;             ///< NET_SERVER_OVERLOAD_POLICY is REJECT
+        uint32_t idle_timeout_ms_ = 0;          ///< NET_SERVER_IDLE_TIMEOUT_MS
+        uint32_t read_timeout_ms_ = 0;          ///< NET_SERVER_READ_TIMEOUT_MS
+        std::atomic<bool> is_deferring_{false};        ///< are the accepts deferred now?
+        std::atomic<int> queued_requests_{0};          ///< the number of the requests in the handler pools
+        std::atomic<uint64_t> accepted_count_{0};      ///< accepted clients
+        std::atomic<uint64_t> rejected_count_{0};      ///< rejected clients
+        std::atomic<uint64_t> deferred_count_{0};      ///< deferrals of the accepts
+        std::atomic<uint64_t> paused_count_{0};        ///< pauses of the reads
+        std::atomic<uint64_t> timed_out_count_{0};     ///< clients closed over the timeouts
     }; // end net_server class
 } // end coral namespace
 
@@ -0,0 +1,401 @@
+/*!
+    \file       net_shm.cpp
+    \brief      Shared memory message channel of co-located processes
+    \details    single producer single consumer rings in a memfd segment with futex wakeups
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#include "net_shm.h"
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    //! "CSHM", the first word of a segment
+    const uint32_t segment_magic = 0x4353484d;
+    //! layout version of a segment
+    const uint32_t segment_version = 1;
+    //! the first bytes of a segment, the rings follow it
+    struct segment_header_t {
+        uint32_t magic;         ///< segment_magic
+        uint32_t version;       ///< segment_version
+        uint64_t ring_size;     ///< bytes of a ring
+    };
+    //! space of segment_header_t, the ring headers stay cache line aligned
+    const size_t segment_header_size = 64;
+    //! the handshake of a client, it comes with the memfd
+    struct offer_t {
+        uint32_t magic;         ///< segment_magic
+        int32_t features;       ///< requested NET_PROTOCOL_FEATURE flags
+    };
+
+    //! bytes of a segment of two rings
+    size_t segment_size_of(size_t ring_size)
+    {
+        return segment_header_size + 2 * (sizeof(coral::net_shm_ring_t::header_t) + ring_size);
+    }
+    //! sleep while *word is value, the futex is shared between processes
+    void futex_wait(std::atomic<uint32_t>& word, uint32_t value, int timeout_ms)
+    {
+        struct timespec timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value, &timeout, nullptr, 0);
+    }
+    //! wake the sleeper of a futex
+    void futex_wake(std::atomic<uint32_t>& word)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+    //! a hint to the core in a polling loop
+    inline void spin_pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    /*! poll a condition for spin_us microseconds
+        \return true if the condition came true
+    */
+    template <class F>
+    bool spin(int spin_us, F&& is_ready)
+    {
+        if (spin_us <= 0) {
+            return false;
+        }
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(spin_us);
+        do {
+            for (int i = 0; i < 64; i++) {
+                if (is_ready()) return true;
+                spin_pause();
+            }
+        } while (std::chrono::steady_clock::now() < until);
+        return false;
+    }
+}
+
+std::string coral::net_shm_path(const std::string& endpoint)
+{
+    size_t prefix_size = std::strlen(NET_SHM_ENDPOINT_PREFIX);
+    if (endpoint.compare(0, prefix_size, NET_SHM_ENDPOINT_PREFIX) != 0) {
+        return std::string();
+    }
+    return endpoint.substr(prefix_size);
+}
+
+void coral::net_shm_ring_t::attach(header_t* header, char* data, size_t capacity)
+{
+    header_ = header;
+    data_ = data;
+    capacity_ = capacity;
+}
+
+size_t coral::net_shm_ring_t::readable() const
+{
+    uint64_t size = header_->tail.load(std::memory_order_acquire) - header_->head.load(std::memory_order_relaxed);
+    return static_cast<size_t>(std::min<uint64_t>(size, capacity_));
+}
+
+size_t coral::net_shm_ring_t::writable() const
+{
+    uint64_t size = header_->tail.load(std::memory_order_relaxed) - header_->head.load(std::memory_order_acquire);
+    return capacity_ - static_cast<size_t>(std::min<uint64_t>(size, capacity_));
+}
+
+size_t coral::net_shm_ring_t::write(const char* data, size_t size)
+{
+    size = std::min(size, writable());
+    if (size == 0) {
+        return 0;
+    }
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    size_t offset = tail & (capacity_ - 1);
+    size_t first = std::min(size, capacity_ - offset);
+    std::memcpy(data_ + offset, data, first);
+    std::memcpy(data_, data + first, size - first);
+    header_->tail.store(tail + size, std::memory_order_release);
+    // pairs with the fence of wait_readable(), either the consumer sees the data or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->is_reader_waiting.load(std::memory_order_relaxed)) {
+        header_->data_seq.fetch_add(1, std::memory_order_relaxed);
+        futex_wake(header_->data_seq);
+    }
+    return size;
+}
+
+size_t coral::net_shm_ring_t::read(char* data, size_t size)
+{
+    size = std::min(size, readable());
+    if (size == 0) {
+        return 0;
+    }
+    uint64_t head = header_->head.load(std::memory_order_relaxed);
+    size_t offset = head & (capacity_ - 1);
+    size_t first = std::min(size, capacity_ - offset);
+    std::memcpy(data, data_ + offset, first);
+    std::memcpy(data + first, data_, size - first);
+    header_->head.store(head + size, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->is_writer_waiting.load(std::memory_order_relaxed)) {
+        header_->space_seq.fetch_add(1, std::memory_order_relaxed);
+        futex_wake(header_->space_seq);
+    }
+    return size;
+}
+
+bool coral::net_shm_ring_t::wait_readable(int timeout_ms, int spin_us)
+{
+    if (readable() > 0 || spin(spin_us, [this] { return readable() > 0; })) {
+        return true;
+    }
+    // a write after the sequence is read changes it, so the futex doesn't sleep through it
+    uint32_t seq = header_->data_seq.load(std::memory_order_acquire);
+    header_->is_reader_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (readable() == 0) {
+        futex_wait(header_->data_seq, seq, timeout_ms);
+    }
+    header_->is_reader_waiting.store(0, std::memory_order_relaxed);
+    return readable() > 0;
+}
+
+bool coral::net_shm_ring_t::wait_writable(int timeout_ms, int spin_us)
+{
+    if (writable() > 0 || spin(spin_us, [this] { return writable() > 0; })) {
+        return true;
+    }
+    uint32_t seq = header_->space_seq.load(std::memory_order_acquire);
+    header_->is_writer_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writable() == 0) {
+        futex_wait(header_->space_seq, seq, timeout_ms);
+    }
+    header_->is_writer_waiting.store(0, std::memory_order_relaxed);
+    return writable() > 0;
+}
+
+coral::net_shm_channel_t::~net_shm_channel_t()
+{
+    if (segment_ != nullptr) {
+        munmap(segment_, segment_size_);
+    }
+}
+
+int coral::net_shm_channel_t::offer(int socket, int features, size_t ring_size)
+{
+    size_t size = min_ring_size;
+    while (size < ring_size) {
+        size <<= 1;
+    }
+    int memfd = memfd_create("coral_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0) {
+        throw coral::network_error(std::string("memfd_create() error:") + std::strerror(errno));
+    }
+    // the server maps it only if its size is sealed
+    if (ftruncate(memfd, segment_size_of(size)) < 0 || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close(memfd);
+        throw coral::network_error(std::string("shared memory error:") + std::strerror(errno));
+    }
+    try {
+        socket_ = socket;
+        map(memfd, size);
+    }
+    catch (...) {
+        close(memfd);
+        throw;
+    }
+
+    offer_t offer;
+    offer.magic = segment_magic;
+    offer.features = features;
+    struct iovec iov;
+    iov.iov_base = &offer;
+    iov.iov_len = sizeof(offer);
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    ssize_t n;
+    do {
+        n = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    // the server has its own descriptor, the mapping stays
+    close(memfd);
+    if (n != static_cast<ssize_t>(sizeof(offer))) {
+        throw coral::network_error("shared memory offer error");
+    }
+
+    int32_t answer = -1;
+    if (net_read_all(socket, &answer, sizeof(answer)) != sizeof(answer) || answer < 0) {
+        throw coral::network_error("shared memory is refused");
+    }
+    codec_.use_protocol(answer);
+    return answer;
+}
+
+void coral::net_shm_channel_t::accept(int socket, int features)
+{
+    offer_t offer;
+    struct iovec iov;
+    iov.iov_base = &offer;
+    iov.iov_len = sizeof(offer);
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    int memfd = -1;
+    struct cmsghdr* cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        std::memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    int32_t answer = -1;
+    try {
+        if (n != static_cast<ssize_t>(sizeof(offer)) || offer.magic != segment_magic || memfd < 0) {
+            throw coral::network_error("shared memory offer error");
+        }
+        socket_ = socket;
+        map(memfd, 0);
+        // the key dictionary and the compression work only on frames, like the hello message
+        answer = offer.features & features;
+        if (!(answer & NET_PROTOCOL_FEATURE_FRAME)) {
+            answer = NET_PROTOCOL_FEATURE_NONE;
+        }
+    }
+    catch (...) {
+        if (memfd >= 0) close(memfd);
+        net_write_all(socket, &answer, sizeof(answer));
+        throw;
+    }
+    close(memfd);
+    if (net_write_all(socket, &answer, sizeof(answer)) < 0) {
+        throw coral::network_error("shared memory answer error");
+    }
+    codec_.use_protocol(answer);
+}
+
+void coral::net_shm_channel_t::map(int memfd, size_t ring_size)
+{
+    bool is_client = ring_size > 0;
+    struct stat file_stat;
+    if (fstat(memfd, &file_stat) < 0 || static_cast<size_t>(file_stat.st_size) < segment_header_size) {
+        throw coral::network_error("shared memory size error");
+    }
+    // the client can't shrink the segment under the mapping of the server
+    if (!is_client && !(fcntl(memfd, F_GET_SEALS) & F_SEAL_SHRINK)) {
+        throw coral::network_error("shared memory isn't sealed");
+    }
+    size_t segment_size = file_stat.st_size;
+    void* segment = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (segment == MAP_FAILED) {
+        throw coral::network_error(std::string("mmap() error:") + std::strerror(errno));
+    }
+    char* base = static_cast<char*>(segment);
+    segment_header_t* header = reinterpret_cast<segment_header_t*>(base);
+    if (is_client) {
+        header->magic = segment_magic;
+        header->version = segment_version;
+        header->ring_size = ring_size;
+    }
+    else {
+        ring_size = header->ring_size;
+        if (header->magic != segment_magic || header->version != segment_version || ring_size < min_ring_size
+            || (ring_size & (ring_size - 1)) != 0 || segment_size_of(ring_size) != segment_size) {
+            munmap(segment, segment_size);
+            throw coral::network_error("shared memory segment error");
+        }
+    }
+    net_shm_ring_t rings[2];
+    for (int i = 0; i < 2; i++) {
+        char* ring = base + segment_header_size + i * (sizeof(net_shm_ring_t::header_t) + ring_size);
+        net_shm_ring_t::header_t* ring_header = reinterpret_cast<net_shm_ring_t::header_t*>(ring);
+        if (is_client) {
+            ring_header = new (ring) net_shm_ring_t::header_t();
+        }
+        rings[i].attach(ring_header, ring + sizeof(net_shm_ring_t::header_t), ring_size);
+    }
+    // the client writes the first ring and the server the second one
+    send_ring_ = rings[is_client ? 0 : 1];
+    recv_ring_ = rings[is_client ? 1 : 0];
+    segment_ = segment;
+    segment_size_ = segment_size;
+}
+
+bool coral::net_shm_channel_t::is_peer_alive() const
+{
+    // nothing comes on the socket after the handshake but its end
+    struct pollfd poll_fd;
+    poll_fd.fd = socket_;
+    poll_fd.events = POLLIN | POLLRDHUP;
+    poll_fd.revents = 0;
+    return poll(&poll_fd, 1, 0) == 0;
+}
+
+int coral::net_shm_channel_t::flush()
+{
+    codec_.end_batch();
+    net_buffer_t& buffer = codec_.send_buffer();
+    size_t size = buffer.size();
+    while (!buffer.empty()) {
+        size_t n = send_ring_.write(buffer.data(), buffer.size());
+        if (n > 0) {
+            buffer.consume(n);
+        }
+        else if (!send_ring_.wait_writable(alive_check_ms, busy_poll_us_) && !is_peer_alive()) {
+            buffer.clear();
+            errno = EPIPE;
+            return -1;
+        }
+    }
+    buffer.clear();
+    return static_cast<int>(size);
+}
+
+ssize_t coral::net_shm_channel_t::fill()
+{
+    const size_t read_size = 0x10000;   // 64KB, same as net_channel_t::fill()
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        size_t n = recv_ring_.read(codec_.recv_buffer().prepare(read_size), read_size);
+        if (n > 0) {
+            codec_.recv_buffer().commit(n);
+            return n;
+        }
+        int timeout_ms = alive_check_ms;
+        if (read_timeout_ms_ > 0) {
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            if (waited >= read_timeout_ms_) {
+                errno = EAGAIN;
+                return -1;
+            }
+            timeout_ms = std::min<int>(timeout_ms, read_timeout_ms_ - waited);
+        }
+        // the peer is checked only when the ring stays empty, so a busy channel makes no system call
+        if (!recv_ring_.wait_readable(timeout_ms, busy_poll_us_) && !is_peer_alive()) {
+            return 0;
+        }
+    }
+}
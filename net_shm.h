@@ -0,0 +1,191 @@
+/*!
+    \file       net_shm.h
+    \brief      Shared memory message channel of co-located processes
+    \details    single producer single consumer rings in a memfd segment with futex wakeups
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#ifndef __CORAL_NETSHM_H__
+#define __CORAL_NETSHM_H__
+
+#include "net_channel.h"
+#include <atomic>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! prefix of a shared memory endpoint, "shm:/path" where /path is the unix domain socket of the handshake
+    constexpr const char* NET_SHM_ENDPOINT_PREFIX = "shm:";
+    /*! the unix domain socket path of a shared memory endpoint
+        \param endpoint "shm:/path" or another endpoint
+        \return the path, empty if endpoint isn't a shared memory endpoint
+    */
+    std::string net_shm_path(const std::string& endpoint);
+
+    //! single producer single consumer byte ring in shared memory
+    /*!
+        the positions only grow and a position is masked into the data, so a ring of a power of 2
+        bytes is never ambiguous between empty and full. a side sleeps on a futex of the ring only
+        after it announced it, so the other side makes a futex call only for a sleeping peer.
+        the positions come from another process, they are clamped before the data is touched.
+    */
+    class net_shm_ring_t {
+    public:
+        //! the shared state of a ring, the data follows it
+        struct header_t {
+            alignas(64) std::atomic<uint64_t> head;     ///< read position, written by the consumer
+            alignas(64) std::atomic<uint64_t> tail;     ///< write position, written by the producer
+            alignas(64) std::atomic<uint32_t> data_seq; ///< futex of the consumer, bumped for a sleeping consumer
+            std::atomic<uint32_t> is_reader_waiting;    ///< is the consumer sleeping?
+            alignas(64) std::atomic<uint32_t> space_seq;    ///< futex of the producer, bumped for a sleeping producer
+            std::atomic<uint32_t> is_writer_waiting;    ///< is the producer sleeping?
+        };
+
+        /*! attach to a ring in a mapped segment
+            \param header shared state
+            \param data shared bytes
+            \param capacity size of data, a power of 2
+        */
+        void attach(header_t* header, char* data, size_t capacity);
+        /*! copy bytes into the ring as much as it takes, it doesn't block
+            \return copied size
+        */
+        size_t write(const char* data, size_t size);
+        /*! copy bytes out of the ring, it doesn't block
+            \param data destination
+            \param size the maximum size
+            \return copied size
+        */
+        size_t read(char* data, size_t size);
+        //! bytes to be read
+        size_t readable() const;
+        //! bytes to be written
+        size_t writable() const;
+        /*! wait for bytes to be read
+            \param timeout_ms the longest sleep
+            \param spin_us microseconds to poll before sleeping on the futex
+            \return false on the timeout
+        */
+        bool wait_readable(int timeout_ms, int spin_us);
+        //! wait for space to be written, like wait_readable()
+        bool wait_writable(int timeout_ms, int spin_us);
+
+    private:
+        header_t* header_ = nullptr;    ///< shared state
+        char* data_ = nullptr;          ///< shared bytes
+        size_t capacity_ = 0;           ///< size of data_
+    }; // class net_shm_ring_t
+
+    //! message channel over shared memory
+    /*!
+        a client makes a memfd segment of two rings, one per direction, and offers it to the
+        server over a connected unix domain socket with SCM_RIGHTS. the server maps it, answers
+        the protocol features over the socket and the messages go through the rings after that,
+        encoded by a net_channel_t like on a socket. the socket stays open to tell that the peer is
+        alive, a closed socket is the end of the channel. a blocking call polls a ring for
+        busy_poll_us() before it sleeps, polling takes a core but saves the wakeup latency.
+    */
+    class net_shm_channel_t {
+    public:
+        //! the smallest ring
+        static constexpr size_t min_ring_size = 0x1000;    // 4KB
+        //! interval to check the peer while waiting
+        static constexpr int alive_check_ms = 100;
+
+        //! default constructor, not connected
+        net_shm_channel_t() = default;
+        //! destructor, unmap the segment, the socket belongs to the caller
+        ~net_shm_channel_t();
+        net_shm_channel_t(const net_shm_channel_t&) = delete;
+        net_shm_channel_t& operator=(const net_shm_channel_t&) = delete;
+
+        /*! client side, make a segment and offer it to the server, it is a blocking call
+            \param socket connected unix domain socket
+            \param features requested NET_PROTOCOL_FEATURE flags
+            \param ring_size bytes of a ring, it is rounded up to a power of 2
+            \return negotiated features
+        */
+        int offer(int socket, int features, size_t ring_size);
+        /*! server side, map the segment offered by the client, it is a blocking call
+            \param socket accepted unix domain socket
+            \param features NET_PROTOCOL_FEATURE flags which the server supports
+        */
+        void accept(int socket, int features);
+        //! codec of the messages, the compression threshold can be set on it
+        net_channel_t& codec() { return codec_; }
+        //! did the last read message come in a batch? it isn't replied
+        bool is_batched() const { return codec_.is_batched(); }
+        //! microseconds a blocking call polls before it sleeps
+        int busy_poll_us() const { return busy_poll_us_; }
+        //! set the microseconds a blocking call polls before it sleeps, 0 sleeps at once
+        void busy_poll_us(int us) { busy_poll_us_ = us; }
+        //! set the milliseconds read_msg() waits for a message, 0 is no limit
+        void read_timeout_ms(uint32_t timeout) { read_timeout_ms_ = timeout; }
+        /*! encode and write a message, it is a blocking call
+            \return written size, -1 if an error occurred
+        */
+        template <class Message>
+        int write_msg(const Message& msg, uint32_t request_id = 0);
+        /*! read and decode a message, it is a blocking call, cmd is -1 on EOF or an error
+            \return used size, 0 on EOF, -1 if an error occurred(EAGAIN on the read timeout)
+        */
+        template <class Message>
+        int read_msg(Message& msg, uint32_t& request_id);
+        //! read and decode a message ignoring the request id
+        template <class Message>
+        int read_msg(Message& msg) { uint32_t request_id = 0; return read_msg(msg, request_id); }
+        /*! write the send buffer of the codec into the ring, it is a blocking call
+            \return written size, -1 if an error occurred
+        */
+        int flush();
+        /*! read bytes from the ring into the receive buffer of the codec, it is a blocking call
+            \return read size, 0 on EOF, -1 if an error occurred(EAGAIN on the read timeout)
+        */
+        ssize_t fill();
+
+    private:
+        /*! map a segment and attach the rings, the client writes the first ring
+            \param memfd the segment
+            \param ring_size client side, bytes of a ring to lay the segment out, 0 on the server side
+        */
+        void map(int memfd, size_t ring_size);
+        //! is the socket of the peer still open?
+        bool is_peer_alive() const;
+
+        int socket_ = -1;               ///< unix domain socket of the peer
+        void* segment_ = nullptr;       ///< mapped segment
+        size_t segment_size_ = 0;       ///< size of segment_
+        net_shm_ring_t send_ring_;      ///< ring to the peer
+        net_shm_ring_t recv_ring_;      ///< ring from the peer
+        net_channel_t codec_;           ///< encoder and decoder of the messages
+        int busy_poll_us_ = 0;          ///< microseconds to poll before sleeping
+        uint32_t read_timeout_ms_ = 0;  ///< read timeout, 0 is no limit
+    }; // class net_shm_channel_t
+
+    template <class Message>
+    int net_shm_channel_t::write_msg(const Message& msg, uint32_t request_id)
+    {
+        codec_.encode(msg, request_id);
+        return flush();
+    }
+
+    template <class Message>
+    int net_shm_channel_t::read_msg(Message& msg, uint32_t& request_id)
+    {
+        while (true) {
+            size_t size = codec_.recv_buffer().size();
+            if (codec_.decode(msg, request_id)) {
+                return size - codec_.recv_buffer().size();
+            }
+            ssize_t n = fill();
+            if (n <= 0) {
+                msg.cmd = -1;
+                msg.clear_data_container();
+                return n;
+            }
+        }
+    }
+} // end coral namespace
+
+#endif // __CORAL_NETSHM_H__
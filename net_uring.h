@@ -0,0 +1,92 @@
+/*!
+    \file       net_uring.h
+    \brief      io_uring submission and completion queues
+    \details    a minimal io_uring wrapper on the raw system calls for the network backends
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+
+#ifndef __CORAL_NETURING_H__
+#define __CORAL_NETURING_H__
+
+#include "exception.h"
+#include <linux/io_uring.h>
+#include <cstdint>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! io_uring instance
+    /*!
+        get_sqe() fills a submission and submit() hands all filled submissions to the kernel
+        in one io_uring_enter call, it can wait for completions in the same call.
+        the completions are taken with for_each_cqe(). it isn't thread safe, a thread owns a ring.
+        it needs Linux 5.6 or later for IORING_OP_ACCEPT, IORING_OP_RECV and IORING_OP_SEND,
+        the constructor throws network_error if io_uring isn't available and the caller falls back.
+    */
+    class net_uring_t {
+    public:
+        /*! constructor
+            \param entries the size of the submission queue, it is rounded up to a power of 2
+        */
+        explicit net_uring_t(unsigned int entries);
+        //! destructor, the pending operations are canceled
+        ~net_uring_t();
+        net_uring_t(const net_uring_t&) = delete;
+        net_uring_t& operator=(const net_uring_t&) = delete;
+
+        /*! get an empty submission
+            \return nullptr if the submission queue is full, submit() and try again
+        */
+        struct io_uring_sqe* get_sqe();
+        /*! submit the filled submissions and wait for completions
+            \param wait_count the number of completions to wait for
+            \return the number of submitted entries, -1 if an error occurred(errno)
+        */
+        int submit(unsigned int wait_count = 0);
+        /*! call f(user_data, res) for each completion and free them
+            \return the number of completions
+        */
+        template <class F>
+        unsigned int for_each_cqe(F&& f);
+
+    private:
+        int fd_ = -1;                       ///< io_uring
+        void* sq_ring_ = nullptr;           ///< mapped submission ring
+        void* cq_ring_ = nullptr;           ///< mapped completion ring, it is sq_ring_ with IORING_FEAT_SINGLE_MMAP
+        size_t sq_ring_size_ = 0;           ///< size of sq_ring_
+        size_t cq_ring_size_ = 0;           ///< size of cq_ring_
+        struct io_uring_sqe* sqes_ = nullptr;   ///< mapped submission entries
+        size_t sqes_size_ = 0;              ///< size of sqes_
+        unsigned int* sq_head_ = nullptr;   ///< consumed by the kernel
+        unsigned int* sq_tail_ = nullptr;   ///< produced by us
+        unsigned int* sq_array_ = nullptr;  ///< indexes of sqes_
+        unsigned int sq_mask_ = 0;          ///< mask of the submission ring
+        unsigned int sq_entries_ = 0;       ///< the number of the submission entries
+        unsigned int sq_local_tail_ = 0;    ///< tail including the filled but not published submissions
+        unsigned int sq_pending_ = 0;       ///< the number of the submissions not handed to the kernel yet
+        unsigned int* cq_head_ = nullptr;   ///< consumed by us
+        unsigned int* cq_tail_ = nullptr;   ///< produced by the kernel
+        unsigned int cq_mask_ = 0;          ///< mask of the completion ring
+        struct io_uring_cqe* cqes_ = nullptr;   ///< completion entries
+    }; // class net_uring_t
+
+    template <class F>
+    unsigned int net_uring_t::for_each_cqe(F&& f)
+    {
+        unsigned int head = *cq_head_;
+        unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned int count = 0;
+        for (; head != tail; head++, count++) {
+            const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            uint64_t user_data = cqe.user_data;
+            int res = cqe.res;
+            // free the entry before the callback, it may submit and complete again
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+            f(user_data, res);
+        }
+        return count;
+    }
+} // end coral namespace
+
+#endif // __CORAL_NETURING_H__
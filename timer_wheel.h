@@ -0,0 +1,177 @@
+/*!
+    \file       timer_wheel.h
+    \brief      Hierarchical timer wheel
+    \details    O(1) timers for a large number of deadlines in one thread, like the connections of a reactor
+    \author     seadog.ahn@gmail.com
+    \date       2007-2023
+    \copyright  All right reserved by seadog.ahn
+*/
+#ifndef __CORAL_TIMER_WHEEL_H__
+#define __CORAL_TIMER_WHEEL_H__
+
+#include <cstdint>
+#include <cstddef>
+
+//! Core Library for Applications and Libraries
+namespace coral {
+    //! hierarchical timer wheel
+    /*!
+        4 levels of 256 slots, a slot of the first level is a tick and a slot of a level is the whole
+        lower level. a timer is linked into the slot of its expiry in O(1) and the timers of a higher
+        level slot are cascaded down when the lower level wraps. with 10ms ticks the levels cover
+        2.56s, 11min, 46h and 497 days. a timer is a node embedded in its owner, so scheduling doesn't
+        allocate. it isn't thread safe, the owner thread schedules and advances it.
+    */
+    class timer_wheel {
+    public:
+        //! a timer entry, it has to be canceled before it is destroyed
+        struct entry_t {
+            entry_t* prev = nullptr;    ///< previous timer of the slot
+            entry_t* next = nullptr;    ///< next timer of the slot
+            uint64_t expiry = 0;        ///< tick of the expiry
+            void* owner = nullptr;      ///< owner of the timer, for the expiry callback
+            //! is it scheduled?
+            bool is_scheduled() const { return prev != nullptr; }
+        };
+
+        /*! constructor
+            \param tick_ms milliseconds of a tick
+            \param now_ms current time in milliseconds
+        */
+        timer_wheel(uint32_t tick_ms, uint64_t now_ms) : tick_ms_(tick_ms), now_tick_(now_ms / tick_ms)
+        {
+            for (auto& level : slots_) {
+                for (auto& slot : level) {
+                    slot.prev = slot.next = &slot;
+                }
+            }
+        }
+        timer_wheel(const timer_wheel&) = delete;
+        timer_wheel& operator=(const timer_wheel&) = delete;
+
+        //! the number of the scheduled timers
+        size_t size() const { return size_; }
+        /*! schedule a timer, a scheduled timer is moved
+            \param timer timer
+            \param expiry_ms time of the expiry in milliseconds, a past time expires on the next tick
+        */
+        void schedule(entry_t& timer, uint64_t expiry_ms)
+        {
+            cancel(timer);
+            // round up, a timer never expires early
+            timer.expiry = (expiry_ms + tick_ms_ - 1) / tick_ms_;
+            if (timer.expiry <= now_tick_) {
+                timer.expiry = now_tick_ + 1;
+            }
+            link(timer);
+            size_++;
+        }
+        //! cancel a timer, it does nothing if the timer isn't scheduled
+        void cancel(entry_t& timer)
+        {
+            if (!timer.is_scheduled()) {
+                return;
+            }
+            timer.prev->next = timer.next;
+            timer.next->prev = timer.prev;
+            timer.prev = timer.next = nullptr;
+            size_--;
+        }
+        /*! advance the time and call on_expiry(timer) for each expired timer
+            \param now_ms current time in milliseconds
+            \param on_expiry callback, it can schedule and cancel timers
+        */
+        template <class F>
+        void advance(uint64_t now_ms, F&& on_expiry)
+        {
+            uint64_t tick = now_ms / tick_ms_;
+            while (now_tick_ < tick) {
+                if (size_ == 0) {
+                    now_tick_ = tick;
+                    return;
+                }
+                now_tick_++;
+                // cascade the higher levels when the lower one wraps
+                for (int level = 1; level < level_size; level++) {
+                    if (((now_tick_ >> (bits * (level - 1))) & mask) != 0) {
+                        break;
+                    }
+                    cascade(slots_[level][(now_tick_ >> (bits * level)) & mask]);
+                }
+                entry_t& slot = slots_[0][now_tick_ & mask];
+                while (slot.next != &slot) {
+                    entry_t& timer = *slot.next;
+                    cancel(timer);
+                    on_expiry(timer);
+                }
+            }
+        }
+        /*! milliseconds to wait for the next advance
+            \param now_ms current time in milliseconds
+            \return -1 if there is no timer, it can be earlier than the next expiry at a cascade
+        */
+        int64_t next_timeout_ms(uint64_t now_ms) const
+        {
+            if (size_ == 0) {
+                return -1;
+            }
+            // the first level up to its wrap, the wrap cascades the next timers
+            uint64_t tick = now_tick_ + 1;
+            while ((tick & mask) != 0 && slots_[0][tick & mask].next == &slots_[0][tick & mask]) {
+                tick++;
+            }
+            uint64_t wake_ms = tick * tick_ms_;
+            return wake_ms > now_ms ? static_cast<int64_t>(wake_ms - now_ms) : 0;
+        }
+
+    private:
+        static constexpr int bits = 8;                      ///< bits of a level
+        static constexpr int level_size = 4;                ///< the number of levels
+        static constexpr uint64_t slot_size = 1 << bits;    ///< slots of a level
+        static constexpr uint64_t mask = slot_size - 1;     ///< mask of a slot index
+
+        //! link a timer into the slot of its expiry
+        void link(entry_t& timer)
+        {
+            uint64_t delta = timer.expiry - now_tick_;
+            int level = 0;
+            while (level < level_size - 1 && delta >= (uint64_t(1) << (bits * (level + 1)))) {
+                level++;
+            }
+            // beyond the wheel, it is cascaded again from the top level
+            uint64_t expiry = delta >> (bits * level_size) ? now_tick_ + (uint64_t(1) << (bits * level_size)) - 1 : timer.expiry;
+            entry_t& slot = slots_[level][(expiry >> (bits * level)) & mask];
+            timer.prev = slot.prev;
+            timer.next = &slot;
+            slot.prev->next = &timer;
+            slot.prev = &timer;
+        }
+        //! move the timers of a slot to the lower levels
+        void cascade(entry_t& slot)
+        {
+            entry_t list;
+            if (slot.next == &slot) {
+                return;
+            }
+            // detach the list, link() may put a timer into the same slot again
+            list.next = slot.next;
+            list.prev = slot.prev;
+            list.next->prev = &list;
+            list.prev->next = &list;
+            slot.prev = slot.next = &slot;
+            while (list.next != &list) {
+                entry_t& timer = *list.next;
+                list.next = timer.next;
+                timer.next->prev = &list;
+                link(timer);
+            }
+        }
+
+        uint32_t tick_ms_;                          ///< milliseconds of a tick
+        uint64_t now_tick_;                         ///< current tick
+        size_t size_ = 0;                           ///< the number of the scheduled timers
+        entry_t slots_[level_size][slot_size];      ///< list heads of the slots
+    }; // class timer_wheel
+} // end coral namespace
+
+#endif // __CORAL_TIMER_WHEEL_H__
@@ -22,186 +22,797 @@ const coral::net_msg_t::value_type& coral::net_msg_t::data_container(const coral
     return data_container_.at(key);
 }
 
+ssize_t coral::net_write_all(int fd, const void* data, size_t size)
+{
+    const char* pos = static_cast<const char*>(data);
+    size_t remain = size;
+    while (remain > 0) {
+        ssize_t n = ::send(fd, pos, remain, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) {
+            n = ::write(fd, pos, remain);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        pos += n;
+        remain -= n;
+    }
+    return size;
+}
+
+std::string coral::net_unix_path(const std::string& endpoint)
+{
+    size_t prefix_size = std::strlen(NET_UNIX_ENDPOINT_PREFIX);
+    if (endpoint.compare(0, prefix_size, NET_UNIX_ENDPOINT_PREFIX) != 0) {
+        return std::string();
+    }
+    return endpoint.substr(prefix_size);
+}
+
+socklen_t coral::net_unix_address(const std::string& path, struct sockaddr_un& address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        return 0;
+    }
+    std::memcpy(address.sun_path, path.data(), path.size());
+    // the abstract namespace has no file, its name starts with a null byte and isn't terminated
+    if (path[0] == '@') {
+        address.sun_path[0] = '\0';
+        return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size());
+    }
+    return static_cast<socklen_t>(sizeof(address));
+}
+
+ssize_t coral::net_read_all(int fd, void* data, size_t size)
+{
+    char* pos = static_cast<char*>(data);
+    size_t remain = size;
+    while (remain > 0) {
+        ssize_t n = ::read(fd, pos, remain);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        pos += n;
+        remain -= n;
+    }
+    return size - remain;
+}
+
+namespace {
+    //! NET_MAX_MSG_SIZE, 0 until it is loaded
+    std::atomic<size_t> gv_max_msg_size(0);
+}
+
+size_t coral::net_max_msg_size()
+{
+    size_t size = gv_max_msg_size.load(std::memory_order_relaxed);
+    if (size == 0) {
+        size = strtoull(coral::config::instance()->get_value("NET_MAX_MSG_SIZE").c_str(), nullptr, 10);
+        if (size == 0) {
+            size = NET_DEFAULT_MAX_MSG_SIZE;
+        }
+        gv_max_msg_size.store(size, std::memory_order_relaxed);
+    }
+    return size;
+}
+
+void coral::net_max_msg_size(size_t size)
+{
+    gv_max_msg_size.store(size == 0 ? NET_DEFAULT_MAX_MSG_SIZE : size, std::memory_order_relaxed);
+}
+
+char* coral::net_buffer_t::prepare(size_t size)
+{
+    if (buffer_.size() - write_pos_ < size) {
+        // move readable bytes to the front before growing the memory
+        if (read_pos_ > 0) {
+            std::memmove(buffer_.data(), buffer_.data() + read_pos_, write_pos_ - read_pos_);
+            write_pos_ -= read_pos_;
+            read_pos_ = 0;
+        }
+        if (buffer_.size() - write_pos_ < size) {
+            buffer_.resize(std::max(buffer_.size() * 2, write_pos_ + size));
+        }
+    }
+    return buffer_.data() + write_pos_;
+}
+
+int coral::net_key_dictionary_t::find_or_add(const std::string& key, bool& is_new)
+{
+    is_new = false;
+    const auto& pos = ids_.find(key);
+    if (pos != ids_.end()) {
+        return pos->second;
+    }
+    if (keys_.size() >= max_size) {
+        return -1;
+    }
+    is_new = true;
+    uint16_t id = keys_.size();
+    ids_.emplace(key, id);
+    keys_.push_back(key);
+    return id;
+}
+
+void coral::net_key_dictionary_t::truncate(size_t size)
+{
+    while (keys_.size() > size) {
+        ids_.erase(keys_.back());
+        keys_.pop_back();
+    }
+}
+
+bool coral::net_key_dictionary_t::define(uint16_t id, const std::string& key)
+{
+    // a decoding of an incomplete message can be retried, so the same key can be defined again
+    if (id < keys_.size()) {
+        return keys_[id] == key;
+    }
+    if (id != keys_.size() || keys_.size() >= max_size) {
+        return false;
+    }
+    keys_.push_back(key);
+    return true;
+}
+
+void coral::net_frame_header_t::encode(char* data) const
+{
+    uint32_t length_temp = htonl(length);
+    uint32_t request_id_temp = htonl(request_id);
+    std::memcpy(data, &length_temp, sizeof(uint32_t));
+    data[4] = version;
+    data[5] = flags;
+    data[6] = data[7] = 0;
+    std::memcpy(data + 8, &request_id_temp, sizeof(uint32_t));
+}
+
+bool coral::net_frame_header_t::decode(const char* data, size_t size)
+{
+    if (size < net_frame_header_t::size) {
+        return false;
+    }
+    std::memcpy(&length, data, sizeof(uint32_t));
+    length = ntohl(length);
+    version = data[4];
+    flags = data[5];
+    std::memcpy(&request_id, data + 8, sizeof(uint32_t));
+    request_id = ntohl(request_id);
+    if (length < net_frame_header_t::size) {
+        throw coral::domain_error("wrong frame length.");
+    }
+    // the receive buffer would grow to the length
+    if (length - net_frame_header_t::size > net_max_msg_size()) {
+        throw coral::domain_error("frame length over the maximum message size.");
+    }
+    return true;
+}
+
+namespace {
+    //! append a type code to the buffer
+    inline void encode_type_code(coral::net_buffer_t& buffer, coral::NET_MSG_TYPE type) {
+        buffer.append(&coral::NET_MSG_TYPE_CODE[type], 1);
+    }
+    //! append a fixed size value to the buffer
+    template <typename T>
+    inline void encode_value(coral::net_buffer_t& buffer, coral::NET_MSG_TYPE type, const T& value) {
+        char* pos = buffer.prepare(1 + sizeof(T));
+        pos[0] = coral::NET_MSG_TYPE_CODE[type];
+        std::memcpy(pos + 1, &value, sizeof(T));
+        buffer.commit(1 + sizeof(T));
+    }
+    //! append a length prefixed string to the buffer
+    inline void encode_string(coral::net_buffer_t& buffer, const char* str, size_t size) {
+        encode_type_code(buffer, coral::NET_MSG_TYPE_STRING);
+        int size_temp = htonl(size);
+        buffer.append(&size_temp, sizeof(int));
+        buffer.append(str, size);
+    }
+    //! wire order of an array element, int arrays are big-endian, double arrays are in the host order like a double value
+    inline int32_t net_order(int32_t value) { return htonl(value); }
+    inline int64_t net_order(int64_t value) { return htobe64(value); }
+    inline double net_order(double value) { return value; }
+    inline char net_order(char value) { return value; }
+    //! does an array element need a byte swap on the wire?
+    template <typename T>
+    struct is_swapped_element : std::integral_constant<bool, std::is_integral<T>::value && (sizeof(T) > 1)> {};
+    //! append a count prefixed array to the buffer, the byte order is handled in one pass
+    template <typename T>
+    inline void encode_array(coral::net_buffer_t& buffer, const std::vector<T>& values) {
+        encode_type_code(buffer, coral::net_value_type<std::vector<T>>::value);
+        int size_temp = htonl(values.size());
+        buffer.append(&size_temp, sizeof(int));
+        size_t size = values.size() * sizeof(T);
+        if (size == 0) {
+            return;
+        }
+        char* pos = buffer.prepare(size);
+        if (!is_swapped_element<T>::value) {
+            std::memcpy(pos, values.data(), size);
+        }
+        else {
+            for (size_t i = 0; i < values.size(); i++) {
+                T value = net_order(values[i]);
+                std::memcpy(pos + i * sizeof(T), &value, sizeof(T));
+            }
+        }
+        buffer.commit(size);
+    }
+    //! append a key to the buffer, using the key dictionary if there is
+    inline void encode_key(coral::net_buffer_t& buffer, extlib::string_view key, coral::net_key_dictionary_t* keys) {
+        bool is_new = false;
+        int id = keys == nullptr ? -1 : keys->find_or_add(std::string(key.data(), key.size()), is_new);
+        if (id < 0) {
+            encode_string(buffer, key.data(), key.size());
+            return;
+        }
+        uint16_t id_temp = htons(id);
+        buffer.append(is_new ? &coral::NET_MSG_KEY_DEFINE_CODE : &coral::NET_MSG_KEY_ID_CODE, 1);
+        buffer.append(&id_temp, sizeof(uint16_t));
+        if (is_new) {
+            int size_temp = htonl(key.size());
+            buffer.append(&size_temp, sizeof(int));
+            buffer.append(key.data(), key.size());
+        }
+    }
+    //! append cmd and the number of fields to the buffer
+    inline void encode_header(coral::net_buffer_t& buffer, int cmd, int size) {
+        int cmd_temp = htonl(cmd);
+        int size_temp = htonl(size);
+        buffer.append(&cmd_temp, sizeof(int));
+        buffer.append(&size_temp, sizeof(int));
+    }
+    //! append a value with its type code to the buffer
+    inline void encode_field_value(coral::net_buffer_t& buffer, bool value)               { encode_value(buffer, coral::NET_MSG_TYPE_BOOL, value);  }
+    inline void encode_field_value(coral::net_buffer_t& buffer, char value)               { encode_value(buffer, coral::NET_MSG_TYPE_CHAR, value);  }
+    inline void encode_field_value(coral::net_buffer_t& buffer, int value)                { encode_value(buffer, coral::NET_MSG_TYPE_INT, static_cast<int>(htonl(value))); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, long value)               { encode_value(buffer, coral::NET_MSG_TYPE_LONG, static_cast<long>(htonl(value))); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, long long value)          { encode_value(buffer, coral::NET_MSG_TYPE_LONGLONG, static_cast<long long>(htobe64(value))); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, unsigned char value)      { encode_value(buffer, coral::NET_MSG_TYPE_UCHAR, value); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, unsigned int value)       { encode_value(buffer, coral::NET_MSG_TYPE_UINT, static_cast<unsigned int>(htonl(value))); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, unsigned long value)      { encode_value(buffer, coral::NET_MSG_TYPE_ULONG, static_cast<unsigned long>(htonl(value))); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, unsigned long long value) { encode_value(buffer, coral::NET_MSG_TYPE_ULONGLONG, static_cast<unsigned long long>(htobe64(value))); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, float value)              { encode_value(buffer, coral::NET_MSG_TYPE_FLOAT, value); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, double value)             { encode_value(buffer, coral::NET_MSG_TYPE_DOUBLE, value); }
+    inline void encode_field_value(coral::net_buffer_t& buffer, const std::string& value) { encode_string(buffer, value.data(), value.size()); }
+    template <typename T>
+    inline void encode_field_value(coral::net_buffer_t& buffer, const std::vector<T>& values) { encode_array(buffer, values); }
+
+    //! type index of a type code, -1 if the code is unknown
+    inline int net_msg_type_index(char code) {
+        for (size_t i = 0; i < sizeof(coral::NET_MSG_TYPE_CODE); i++) {
+            if (coral::NET_MSG_TYPE_CODE[i] == code) return i;
+        }
+        return -1;
+    }
+    //! wire size of a fixed size value, 0 for a length prefixed value
+    inline size_t net_msg_type_size(coral::NET_MSG_TYPE type) {
+        switch (type) {
+            case coral::NET_MSG_TYPE_BOOL:      return sizeof(bool);
+            case coral::NET_MSG_TYPE_CHAR:      return sizeof(char);
+            case coral::NET_MSG_TYPE_INT:       return sizeof(int);
+            case coral::NET_MSG_TYPE_LONG:      return sizeof(long);
+            case coral::NET_MSG_TYPE_LONGLONG:  return sizeof(long long);
+            case coral::NET_MSG_TYPE_UCHAR:     return sizeof(unsigned char);
+            case coral::NET_MSG_TYPE_UINT:      return sizeof(unsigned int);
+            case coral::NET_MSG_TYPE_ULONG:     return sizeof(unsigned long);
+            case coral::NET_MSG_TYPE_ULONGLONG: return sizeof(unsigned long long);
+            case coral::NET_MSG_TYPE_FLOAT:     return sizeof(float);
+            case coral::NET_MSG_TYPE_DOUBLE:    return sizeof(double);
+            default:                            return 0;
+        }
+    }
+    //! wire size of an element of a length prefixed value
+    inline size_t net_msg_element_size(coral::NET_MSG_TYPE type) {
+        switch (type) {
+            case coral::NET_MSG_TYPE_DOUBLE_ARRAY: return sizeof(double);
+            case coral::NET_MSG_TYPE_INT32_ARRAY:  return sizeof(int32_t);
+            case coral::NET_MSG_TYPE_INT64_ARRAY:  return sizeof(int64_t);
+            default:                               return 1;
+        }
+    }
+    //! print array elements separated by a space
+    template <typename T>
+    inline void print_array(std::ostream& os, const std::vector<T>& values) {
+        os << '[';
+        for (size_t i = 0; i < values.size(); i++) {
+            os << (i == 0 ? "" : " ") << values[i];
+        }
+        os << ']';
+    }
+    //! print the size of a byte array
+    inline void print_array(std::ostream& os, const std::vector<char>& values) {
+        os << '[' << values.size() << " bytes]";
+    }
+
+    //! reader of received bytes in the memory, it fails when the bytes are not enough
+    class buffer_reader {
+    public:
+        buffer_reader(const char* data, size_t size) : begin_(data), pos_(data), end_(data + size) {}
+        bool read(void* value, size_t size) {
+            if (static_cast<size_t>(end_ - pos_) < size) return false;
+            std::memcpy(value, pos_, size);
+            pos_ += size;
+            return true;
+        }
+        bool read_string(std::string& str, size_t size) {
+            if (static_cast<size_t>(end_ - pos_) < size) return false;
+            str.assign(pos_, size);
+            pos_ += size;
+            return true;
+        }
+        bool can_read(size_t size) const { return static_cast<size_t>(end_ - pos_) >= size; }
+        size_t used() const { return pos_ - begin_; }
+    private:
+        const char* begin_;
+        const char* pos_;
+        const char* end_;
+    };
+    //! reader of a file, it fails on EOF or an error
+    class fd_reader {
+    public:
+        explicit fd_reader(int fd) : fd_(fd) {}
+        bool read(void* value, size_t size) {
+            ssize_t n = coral::net_read_all(fd_, value, size);
+            if (n < 0) error_ = true;
+            if (n <= 0) return false;
+            used_ += n;
+            return static_cast<size_t>(n) == size;
+        }
+        bool read_string(std::string& str, size_t size) {
+            str.resize(size);
+            return size == 0 || read(&str[0], size);
+        }
+        bool can_read(size_t) const { return true; }
+        size_t used() const { return used_; }
+        bool error() const { return error_; }
+    private:
+        int fd_;
+        size_t used_ = 0;
+        bool error_ = false;
+    };
+    //! read a length prefixed string
+    template <class Reader>
+    inline bool decode_string(Reader& reader, std::string& str) {
+        uint32_t size = 0;
+        if (!reader.read(&size, sizeof(int))) return false;
+        size = ntohl(size);
+        // a reader of a file allocates the string before it is read
+        if (size > coral::net_max_msg_size()) {
+            throw coral::domain_error("string length over the maximum message size.");
+        }
+        return reader.read_string(str, size);
+    }
+    //! read a key, a literal key or a key of the key dictionary
+    template <class Reader>
+    inline bool decode_key(Reader& reader, std::string& key, coral::net_key_dictionary_t* keys) {
+        char key_type = 0;
+        if (!reader.read(&key_type, sizeof(char))) return false;
+        if (key_type != coral::NET_MSG_KEY_DEFINE_CODE && key_type != coral::NET_MSG_KEY_ID_CODE) {
+            return decode_string(reader, key);
+        }
+        uint16_t id = 0;
+        if (keys == nullptr) {
+            throw coral::domain_error("a key id without the key dictionary.");
+        }
+        if (!reader.read(&id, sizeof(uint16_t))) return false;
+        id = ntohs(id);
+        if (key_type == coral::NET_MSG_KEY_DEFINE_CODE) {
+            if (!decode_string(reader, key)) return false;
+            if (!keys->define(id, key)) {
+                throw coral::domain_error("wrong key id definition.");
+            }
+            return true;
+        }
+        const std::string* key_found = keys->find(id);
+        if (key_found == nullptr) {
+            throw coral::domain_error("undefined key id.");
+        }
+        key = *key_found;
+        return true;
+    }
+    //! read a count prefixed array, the byte order is handled in one pass
+    template <typename T, class Reader>
+    inline bool decode_array(Reader& reader, std::vector<T>& values) {
+        int count = 0;
+        if (!reader.read(&count, sizeof(int))) return false;
+        count = ntohl(count);
+        if (count < 0) {
+            throw coral::domain_error("wrong array size in the message.");
+        }
+        size_t size = count * sizeof(T);
+        // a reader of a file can't tell the received bytes, the count is checked before the allocation
+        if (size > coral::net_max_msg_size()) {
+            throw coral::domain_error("array size over the maximum message size.");
+        }
+        // don't allocate for an array which isn't received yet
+        if (!reader.can_read(size)) return false;
+        values.resize(count);
+        if (size > 0 && !reader.read(values.data(), size)) return false;
+        if (is_swapped_element<T>::value) {
+            for (auto& value : values) value = net_order(value);
+        }
+        return true;
+    }
+    //! read an array and store it into the data container
+    template <typename T, class Reader, class Container>
+    inline bool decode_array_value(Reader& reader, Container& data, std::string& key) {
+        std::vector<T> val;
+        if (!decode_array(reader, val)) return false;
+        data[std::move(key)] = std::move(val);
+        return true;
+    }
+    //! read a fixed size value and store it into the data container
+    template <typename T, class Reader, class Container>
+    inline bool decode_value(Reader& reader, Container& data, std::string& key) {
+        T val = 0;
+        if (!reader.read(&val, sizeof(T))) return false;
+        data[std::move(key)] = val;
+        return true;
+    }
+    //! read a message, Container is net_msg_t::data_container_t or net_variant_msg_t::data_container_t
+    template <class Reader, class Container>
+    bool decode_message(Reader& reader, int& cmd, Container& data, coral::net_key_dictionary_t* keys = nullptr)
+    {
+        data.clear();
+        int size = 0;
+        if (!reader.read(&cmd, sizeof(int)) || !reader.read(&size, sizeof(int))) {
+            return false;
+        }
+        cmd = ntohl(cmd);
+        size = ntohl(size);
+        for (int i = 0; i < size; i++) {
+            std::string key_str;
+            if (!decode_key(reader, key_str, keys)) {
+                return false;
+            }
+            char val_type = 0;
+            if (!reader.read(&val_type, sizeof(char))) {
+                return false;
+            }
+            bool is_read = false;
+            switch (val_type) {
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_BOOL]:
+                    is_read = decode_value<bool>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_CHAR]:
+                    is_read = decode_value<char>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_INT]: {
+                    int val = 0;
+                    if ((is_read = reader.read(&val, sizeof(int)))) {
+                        data[key_str] = static_cast<int>(ntohl(val));
+                    }
+                    break;
+                }
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_LONG]: {
+                    long val = 0;
+                    if ((is_read = reader.read(&val, sizeof(long)))) {
+                        data[key_str] = static_cast<long>(ntohl(val));
+                    }
+                    break;
+                }
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_LONGLONG]: {
+                    long long val = 0;
+                    if ((is_read = reader.read(&val, sizeof(long long)))) {
+                        data[key_str] = static_cast<long long>(be64toh(val));
+                    }
+                    break;
+                }
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_UCHAR]:
+                    is_read = decode_value<unsigned char>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_UINT]: {
+                    unsigned int val = 0;
+                    if ((is_read = reader.read(&val, sizeof(unsigned int)))) {
+                        data[key_str] = static_cast<unsigned int>(ntohl(val));
+                    }
+                    break;
+                }
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_ULONG]: {
+                    unsigned long val = 0;
+                    if ((is_read = reader.read(&val, sizeof(unsigned long)))) {
+                        data[key_str] = static_cast<unsigned long>(ntohl(val));
+                    }
+                    break;
+                }
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_ULONGLONG]: {
+                    unsigned long long val = 0;
+                    if ((is_read = reader.read(&val, sizeof(unsigned long long)))) {
+                        data[key_str] = static_cast<unsigned long long>(be64toh(val));
+                    }
+                    break;
+                }
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_FLOAT]:
+                    is_read = decode_value<float>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_DOUBLE]:
+                    is_read = decode_value<double>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_STRING]: {
+                    std::string val;
+                    if ((is_read = decode_string(reader, val))) {
+                        data[key_str] = std::move(val);
+                    }
+                    break;
+                }
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_DOUBLE_ARRAY]:
+                    is_read = decode_array_value<double>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_INT32_ARRAY]:
+                    is_read = decode_array_value<int32_t>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_INT64_ARRAY]:
+                    is_read = decode_array_value<int64_t>(reader, data, key_str);
+                    break;
+                case coral::NET_MSG_TYPE_CODE[coral::NET_MSG_TYPE_BYTES]:
+                    is_read = decode_array_value<char>(reader, data, key_str);
+                    break;
+                default:
+                    throw coral::domain_error("unknown value type code of " + key_str + " in the message.");
+            }
+            if (!is_read) {
+                return false;
+            }
+        }
+        return true;
+    }
+    //! read a message from a file without buffering
+    template <class Container>
+    int read_message(int fd, int& cmd, Container& data)
+    {
+        fd_reader reader(fd);
+        if (!decode_message(reader, cmd, data)) {
+            cmd = -1;
+            data.clear();
+            return reader.error() ? -1 : 0;
+        }
+        return reader.used();
+    }
+    //! measures a legacy message while its bytes come in, the scan goes on from the last whole field
+    class msg_scanner {
+    public:
+        /*! scan the received bytes of the message, the bytes scanned before are skipped
+            \param data the received bytes from the start of the message
+            \param size the number of received bytes
+            \return true once the message is whole, size() is its length
+        */
+        bool scan(const char* data, size_t size) {
+            if (fields_ < 0) {
+                if (size < 2 * sizeof(int)) return false;
+                int field_size = 0;
+                std::memcpy(&field_size, data + sizeof(int), sizeof(int));
+                fields_ = std::max<int>(ntohl(field_size), 0);
+                pos_ = 2 * sizeof(int);
+            }
+            while (fields_ > 0) {
+                size_t pos = pos_;
+                // a key, a literal key has a type code and a length ahead of it
+                if (size - pos < 1) return false;
+                if (data[pos] == coral::NET_MSG_KEY_ID_CODE) {
+                    pos += 1 + sizeof(uint16_t);
+                }
+                else {
+                    size_t code_size = data[pos] == coral::NET_MSG_KEY_DEFINE_CODE ? 1 + sizeof(uint16_t) : 1;
+                    if (!skip_length(data, size, pos, code_size, 1)) return false;
+                }
+                // a value
+                if (pos >= size) return false;
+                int type = net_msg_type_index(data[pos]);
+                if (type < 0) {
+                    throw coral::domain_error("unknown value type code in the message.");
+                }
+                size_t value_size = net_msg_type_size(static_cast<coral::NET_MSG_TYPE>(type));
+                if (value_size == 0) {
+                    if (!skip_length(data, size, pos, 1, net_msg_element_size(static_cast<coral::NET_MSG_TYPE>(type)))) return false;
+                }
+                else {
+                    pos += 1 + value_size;
+                }
+                if (pos > size) return false;
+                pos_ = pos;
+                fields_--;
+            }
+            return true;
+        }
+        //! bytes of the whole fields scanned, the length of the message once scan() is true
+        size_t size() const { return pos_; }
+    private:
+        //! move pos over a length prefixed value, false if its bytes aren't received yet
+        static bool skip_length(const char* data, size_t size, size_t& pos, size_t code_size, size_t element_size) {
+            if (size - pos < code_size + sizeof(int)) return false;
+            int count = 0;
+            std::memcpy(&count, data + pos + code_size, sizeof(int));
+            count = ntohl(count);
+            if (count < 0) {
+                throw coral::domain_error("wrong length in the message.");
+            }
+            size_t length = count * element_size;
+            // the receive buffer would grow to the length
+            if (length > coral::net_max_msg_size()) {
+                throw coral::domain_error("length over the maximum message size.");
+            }
+            pos += code_size + sizeof(int) + length;
+            return pos <= size;
+        }
+        size_t pos_ = 0;    ///< end of the whole fields scanned
+        int fields_ = -1;   ///< fields left to scan, -1 before the header
+    };
+    //! read into the receive buffer until a whole legacy message is in it
+    inline ssize_t read_whole_message(int fd, coral::net_buffer_t& buffer)
+    {
+        const size_t read_size = 0x10000;   // 64KB
+        // a message might be received already with the previous one, it is decoded once after it is whole
+        msg_scanner scanner;
+        while (!scanner.scan(buffer.data(), buffer.size())) {
+            ssize_t n = ::read(fd, buffer.prepare(read_size), read_size);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                return n;
+            }
+            buffer.commit(n);
+        }
+        return scanner.size();
+    }
+    //! read a message through the receive buffer of the connection
+    template <class Message>
+    int read_message(int fd, coral::net_buffer_t& buffer, Message& msg)
+    {
+        size_t used = 0;
+        ssize_t n = read_whole_message(fd, buffer);
+        if (n <= 0) {
+            msg.cmd = -1;
+            msg.clear_data_container();
+            return n < 0 ? -1 : 0;
+        }
+        if (!msg.decode(buffer.data(), buffer.size(), used)) {
+            throw coral::domain_error("malformed message.");
+        }
+        buffer.consume(used);
+        return used;
+    }
+}
+
+void coral::net_encode_header(net_buffer_t& buffer, int cmd, int size)
+{
+    encode_header(buffer, cmd, size);
+}
+
+template <typename T>
+void coral::net_encode_field(net_buffer_t& buffer, extlib::string_view key, const T& value, net_key_dictionary_t* keys)
+{
+    encode_key(buffer, key, keys);
+    encode_field_value(buffer, value);
+}
+
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const bool&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const char&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const int&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const long&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const long long&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const unsigned char&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const unsigned int&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const unsigned long&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const unsigned long long&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const float&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const double&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const std::string&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const std::vector<double>&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const std::vector<int32_t>&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const std::vector<int64_t>&, net_key_dictionary_t*);
+template void coral::net_encode_field(net_buffer_t&, extlib::string_view, const std::vector<char>&, net_key_dictionary_t*);
+
 int coral::net_msg_t::write_to_network(int fd)
 {
-    int nWrittenSize = 0;
-    int cmd_temp = htonl(cmd);
-    int size_temp = htonl(size());
-    nWrittenSize += write(fd, &cmd_temp, sizeof(int));
-    nWrittenSize += write(fd, &size_temp, sizeof(int));
+    static thread_local net_buffer_t buffer;
+    return write_to_network(fd, buffer);
+}
+
+int coral::net_msg_t::write_to_network(int fd, net_buffer_t& buffer)
+{
+    buffer.clear();
+    encode(buffer);
+    return net_write_all(fd, buffer.data(), buffer.size());
+}
+
+void coral::net_msg_t::encode(net_buffer_t& buffer, net_key_dictionary_t* keys) const
+{
+    encode_header(buffer, cmd, size());
     for (const auto& e : data_container_) {
         // wirte key
-        nWrittenSize += write_string_to_network(fd, extlib::any_cast<std::string>(e.first));
+        encode_key(buffer, e.first, keys);
         // wirte value
         if (e.second.type() == typeid(bool)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_BOOL], 1);
-            bool b = extlib::any_cast<bool>(e.second);
-            nWrittenSize += write(fd, &b, sizeof(bool));
+            encode_value(buffer, NET_MSG_TYPE_BOOL, extlib::any_cast<bool>(e.second));
         }
         else if (e.second.type() == typeid(char)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_CHAR], 1);
-            char c = extlib::any_cast<char>(e.second);
-            nWrittenSize += write(fd, &c, sizeof(char));
+            encode_value(buffer, NET_MSG_TYPE_CHAR, extlib::any_cast<char>(e.second));
         }
         else if (e.second.type() == typeid(int)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_INT], 1);
             int n = htonl(extlib::any_cast<int>(e.second));
-            nWrittenSize += write(fd, &n, sizeof(int));
+            encode_value(buffer, NET_MSG_TYPE_INT, n);
         }
         else if (e.second.type() == typeid(long)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_LONG], 1);
             long n = htonl(extlib::any_cast<long>(e.second));
-            nWrittenSize += write(fd, &n, sizeof(long));
+            encode_value(buffer, NET_MSG_TYPE_LONG, n);
         }
         else if (e.second.type() == typeid(long long)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_LONGLONG], 1);
             long long n = htobe64(extlib::any_cast<long long>(e.second));
-            nWrittenSize += write(fd, &n, sizeof(long long));
+            encode_value(buffer, NET_MSG_TYPE_LONGLONG, n);
         }
         else if (e.second.type() == typeid(unsigned char)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_UCHAR], 1);
-            unsigned char c = extlib::any_cast<unsigned char>(e.second);
-            nWrittenSize += write(fd, &c, sizeof(unsigned char));
+            encode_value(buffer, NET_MSG_TYPE_UCHAR, extlib::any_cast<unsigned char>(e.second));
         }
         else if (e.second.type() == typeid(unsigned int)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_UINT], 1);
             unsigned int n = htonl(extlib::any_cast<unsigned int>(e.second));
-            nWrittenSize += write(fd, &n, sizeof(unsigned int));
+            encode_value(buffer, NET_MSG_TYPE_UINT, n);
         }
         else if (e.second.type() == typeid(unsigned long)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_ULONG], 1);
             unsigned long n = htonl(extlib::any_cast<unsigned long>(e.second));
-            nWrittenSize += write(fd, &n, sizeof(unsigned long));
+            encode_value(buffer, NET_MSG_TYPE_ULONG, n);
         }
         else if (e.second.type() == typeid(unsigned long long)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_ULONGLONG], 1);
             unsigned long long n = htobe64(extlib::any_cast<unsigned long long>(e.second));
-            nWrittenSize += write(fd, &n, sizeof(unsigned long long));
+            encode_value(buffer, NET_MSG_TYPE_ULONGLONG, n);
         }
         else if (e.second.type() == typeid(float)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_FLOAT], 1);
-            double dbl = extlib::any_cast<float>(e.second);
-            nWrittenSize += write(fd, &dbl, sizeof(float));
+            encode_value(buffer, NET_MSG_TYPE_FLOAT, extlib::any_cast<float>(e.second));
         }
         else if (e.second.type() == typeid(double)) {
-            nWrittenSize += write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_DOUBLE], 1);
-            double dbl = extlib::any_cast<double>(e.second);
-            nWrittenSize += write(fd, &dbl, sizeof(double));
+            encode_value(buffer, NET_MSG_TYPE_DOUBLE, extlib::any_cast<double>(e.second));
         }
         else if (e.second.type() == typeid(char*)) {
-            std::string str(extlib::any_cast<char*>(e.second));
-            nWrittenSize += write_string_to_network(fd, str);
+            const char* str = extlib::any_cast<char*>(e.second);
+            encode_string(buffer, str, std::strlen(str));
         }
         else if (e.second.type() == typeid(const char*)) {
-            std::string str(extlib::any_cast<const char*>(e.second));
-            nWrittenSize += write_string_to_network(fd, str);
+            const char* str = extlib::any_cast<const char*>(e.second);
+            encode_string(buffer, str, std::strlen(str));
         }
         else if (e.second.type() == typeid(std::string)) {
-            nWrittenSize += write_string_to_network(fd, extlib::any_cast<std::string>(e.second));
+            const std::string& str = extlib::any_cast<const std::string&>(e.second);
+            encode_string(buffer, str.data(), str.size());
+        }
+        else if (e.second.type() == typeid(std::vector<double>)) {
+            encode_array(buffer, extlib::any_cast<const std::vector<double>&>(e.second));
+        }
+        else if (e.second.type() == typeid(std::vector<int32_t>)) {
+            encode_array(buffer, extlib::any_cast<const std::vector<int32_t>&>(e.second));
+        }
+        else if (e.second.type() == typeid(std::vector<int64_t>)) {
+            encode_array(buffer, extlib::any_cast<const std::vector<int64_t>&>(e.second));
+        }
+        else if (e.second.type() == typeid(std::vector<char>)) {
+            encode_array(buffer, extlib::any_cast<const std::vector<char>&>(e.second));
+        }
+        else {
+            throw coral::domain_error("unsupported value type of " + e.first + " in the data_container.");
         }
     }
-    return nWrittenSize;
 }
 
 int coral::net_msg_t::read_from_network(int fd)
 {
-    int nReadSize = 0;
-    data_container_.clear();
-    nReadSize += read(fd, &cmd, sizeof(int));
-    cmd = ntohl(cmd);
-    int size = 0;
-    nReadSize += read(fd, &size, sizeof(int));
-    size = ntohl(size);
-    for (int i = 0; i < size; i++) {
-        char key_type = 0;
-        nReadSize += read(fd, &key_type, sizeof(char));
-        std::string key_str;
-        nReadSize += read_string_from_network(fd, key_str);
-
-        char val_type = 0;
-        nReadSize += read(fd, &val_type, sizeof(char));
-        switch (val_type) {
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_BOOL]: {
-                bool val = false;
-                nReadSize += read(fd, &val, sizeof(bool));
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_CHAR]: {
-                char val = 0;
-                nReadSize += read(fd, &val, sizeof(char));
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_INT]: {
-                int val = 0;
-                nReadSize += read(fd, &val, sizeof(int));
-                val = ntohl(val);
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_LONG]: {
-                long val = 0;
-                nReadSize += read(fd, &val, sizeof(long));
-                val = ntohl(val);
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_LONGLONG]: {
-                long long val = 0;
-                nReadSize += read(fd, &val, sizeof(long long));
-                val = be64toh(val);
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_UCHAR]: {
-                unsigned char val = 0;
-                nReadSize += read(fd, &val, sizeof(unsigned char));
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_UINT]: {
-                unsigned int val = 0;
-                nReadSize += read(fd, &val, sizeof(unsigned int));
-                val = ntohl(val);
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_ULONG]: {
-                unsigned long val = 0;
-                nReadSize += read(fd, &val, sizeof(unsigned long));
-                val = ntohl(val);
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_ULONGLONG]: {
-                unsigned long long val = 0;
-                nReadSize += read(fd, &val, sizeof(unsigned long long));
-                val = be64toh(val);
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_FLOAT]: {
-                float val = 0;
-                nReadSize += read(fd, &val, sizeof(float));
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_DOUBLE]: {
-                double val = 0;
-                nReadSize += read(fd, &val, sizeof(double));
-                data_container_[key_str] = val;
-                break;
-            }
-            case NET_MSG_TYPE_CODE[NET_MSG_TYPE_STRING]: {
-                std::string val;
-                nReadSize += read_string_from_network(fd, val);
-                data_container_[key_str] = std::move(val);
-                break;
-            }
-        }
+    return read_message(fd, cmd, data_container_);
+}
+
+int coral::net_msg_t::read_from_network(int fd, net_buffer_t& buffer)
+{
+    return read_message(fd, buffer, *this);
+}
+
+bool coral::net_msg_t::decode(const char* data, size_t size, size_t& used, net_key_dictionary_t* keys)
+{
+    buffer_reader reader(data, size);
+    if (!decode_message(reader, cmd, data_container_, keys)) {
+        return false;
     }
-    return nReadSize;
+    used = reader.used();
+    return true;
 }
 
 //! clear
@@ -234,6 +845,10 @@ const std::string coral::net_msg_t::to_string() const {
         else if (e.second.type() == typeid(char*))              { oss << extlib::any_cast<char*>(e.second);             }
         else if (e.second.type() == typeid(char const *))       { oss << extlib::any_cast<char const *>(e.second);      }
         else if (e.second.type() == typeid(std::string))        { oss << extlib::any_cast<std::string>(e.second);       }
+        else if (e.second.type() == typeid(std::vector<double>))  { print_array(oss, extlib::any_cast<const std::vector<double>&>(e.second));  }
+        else if (e.second.type() == typeid(std::vector<int32_t>)) { print_array(oss, extlib::any_cast<const std::vector<int32_t>&>(e.second)); }
+        else if (e.second.type() == typeid(std::vector<int64_t>)) { print_array(oss, extlib::any_cast<const std::vector<int64_t>&>(e.second)); }
+        else if (e.second.type() == typeid(std::vector<char>))    { print_array(oss, extlib::any_cast<const std::vector<char>&>(e.second));    }
         oss << ',';
     }
     return oss.str();
@@ -244,24 +859,353 @@ std::ostream& operator<<(std::ostream& os, coral::net_msg_t& msg) {
     return os;
 }
 
-int coral::net_msg_t::write_string_to_network(int fd, const std::string& str)
+void coral::net_value_t::check_type(NET_MSG_TYPE type) const
+{
+    if (type_ != type) {
+        throw coral::domain_error(std::string("net_value_t type mismatch, the value type code is ") + NET_MSG_TYPE_CODE[type_]);
+    }
+}
+
+std::string coral::net_value_t::to_string() const
+{
+    std::ostringstream oss;
+    switch (type_) {
+        case NET_MSG_TYPE_BOOL:      oss << scalar_.b; break;
+        case NET_MSG_TYPE_CHAR:      oss << scalar_.c; break;
+        case NET_MSG_TYPE_INT:       oss << scalar_.i; break;
+        case NET_MSG_TYPE_LONG:      oss << scalar_.l; break;
+        case NET_MSG_TYPE_LONGLONG:  oss << scalar_.x; break;
+        case NET_MSG_TYPE_UCHAR:     oss << scalar_.h; break;
+        case NET_MSG_TYPE_UINT:      oss << scalar_.j; break;
+        case NET_MSG_TYPE_ULONG:     oss << scalar_.m; break;
+        case NET_MSG_TYPE_ULONGLONG: oss << scalar_.y; break;
+        case NET_MSG_TYPE_FLOAT:     oss << scalar_.f; break;
+        case NET_MSG_TYPE_DOUBLE:    oss << scalar_.d; break;
+        case NET_MSG_TYPE_STRING:    return str_;
+        case NET_MSG_TYPE_DOUBLE_ARRAY: print_array(oss, get<std::vector<double>>());  break;
+        case NET_MSG_TYPE_INT32_ARRAY:  print_array(oss, get<std::vector<int32_t>>()); break;
+        case NET_MSG_TYPE_INT64_ARRAY:  print_array(oss, get<std::vector<int64_t>>()); break;
+        case NET_MSG_TYPE_BYTES:        print_array(oss, get<std::vector<char>>());    break;
+    }
+    return oss.str();
+}
+
+const coral::net_variant_msg_t::value_type& coral::net_variant_msg_t::data_container(const key_type& key) const
+{
+    const auto& pos = data_container_.find(key);
+    if (pos == data_container_.end())
+        throw coral::domain_error("There is no " + key + " in the data_container.");
+    return pos->second;
+}
+
+int coral::net_variant_msg_t::write_to_network(int fd)
+{
+    static thread_local net_buffer_t buffer;
+    return write_to_network(fd, buffer);
+}
+
+int coral::net_variant_msg_t::write_to_network(int fd, net_buffer_t& buffer)
+{
+    buffer.clear();
+    encode(buffer);
+    return net_write_all(fd, buffer.data(), buffer.size());
+}
+
+void coral::net_variant_msg_t::encode(net_buffer_t& buffer, net_key_dictionary_t* keys) const
+{
+    encode_header(buffer, cmd, size());
+    for (const auto& e : data_container_) {
+        encode_key(buffer, e.first, keys);
+        const net_value_t& val = e.second;
+        switch (val.type()) {
+            case NET_MSG_TYPE_BOOL:      encode_value(buffer, NET_MSG_TYPE_BOOL, val.get<bool>());                        break;
+            case NET_MSG_TYPE_CHAR:      encode_value(buffer, NET_MSG_TYPE_CHAR, val.get<char>());                        break;
+            case NET_MSG_TYPE_INT:       encode_value(buffer, NET_MSG_TYPE_INT, static_cast<int>(htonl(val.get<int>())));  break;
+            case NET_MSG_TYPE_LONG:      encode_value(buffer, NET_MSG_TYPE_LONG, static_cast<long>(htonl(val.get<long>()))); break;
+            case NET_MSG_TYPE_LONGLONG:  encode_value(buffer, NET_MSG_TYPE_LONGLONG, static_cast<long long>(htobe64(val.get<long long>()))); break;
+            case NET_MSG_TYPE_UCHAR:     encode_value(buffer, NET_MSG_TYPE_UCHAR, val.get<unsigned char>());              break;
+            case NET_MSG_TYPE_UINT:      encode_value(buffer, NET_MSG_TYPE_UINT, static_cast<unsigned int>(htonl(val.get<unsigned int>()))); break;
+            case NET_MSG_TYPE_ULONG:     encode_value(buffer, NET_MSG_TYPE_ULONG, static_cast<unsigned long>(htonl(val.get<unsigned long>()))); break;
+            case NET_MSG_TYPE_ULONGLONG: encode_value(buffer, NET_MSG_TYPE_ULONGLONG, static_cast<unsigned long long>(htobe64(val.get<unsigned long long>()))); break;
+            case NET_MSG_TYPE_FLOAT:     encode_value(buffer, NET_MSG_TYPE_FLOAT, val.get<float>());                      break;
+            case NET_MSG_TYPE_DOUBLE:    encode_value(buffer, NET_MSG_TYPE_DOUBLE, val.get<double>());                    break;
+            case NET_MSG_TYPE_STRING: {
+                const std::string& str = val.get<std::string>();
+                encode_string(buffer, str.data(), str.size());
+                break;
+            }
+            case NET_MSG_TYPE_DOUBLE_ARRAY: encode_array(buffer, val.get<std::vector<double>>());  break;
+            case NET_MSG_TYPE_INT32_ARRAY:  encode_array(buffer, val.get<std::vector<int32_t>>()); break;
+            case NET_MSG_TYPE_INT64_ARRAY:  encode_array(buffer, val.get<std::vector<int64_t>>()); break;
+            case NET_MSG_TYPE_BYTES:        encode_array(buffer, val.get<std::vector<char>>());    break;
+        }
+    }
+}
+
+int coral::net_variant_msg_t::read_from_network(int fd)
+{
+    return read_message(fd, cmd, data_container_);
+}
+
+int coral::net_variant_msg_t::read_from_network(int fd, net_buffer_t& buffer)
+{
+    return read_message(fd, buffer, *this);
+}
+
+bool coral::net_variant_msg_t::decode(const char* data, size_t size, size_t& used, net_key_dictionary_t* keys)
+{
+    buffer_reader reader(data, size);
+    if (!decode_message(reader, cmd, data_container_, keys)) {
+        return false;
+    }
+    used = reader.used();
+    return true;
+}
+
+const std::string coral::net_variant_msg_t::to_string() const {
+    std::ostringstream oss;
+    oss << "CMD:" << cmd << ',' << "SIZE:" << size() << ',' << "DATA:";
+    for (const auto& e: data_container_) {
+        oss << e.first << '=' << e.second.to_string() << ',';
+    }
+    return oss.str();
+}
+
+std::ostream& operator<<(std::ostream& os, const coral::net_variant_msg_t& msg) {
+    os << msg.to_string();
+    return os;
+}
+
+const coral::net_msg_view_t::field_t* coral::net_msg_view_t::find(extlib::string_view key) const
+{
+    for (const auto& field : fields_) {
+        if (field.key == key) return &field;
+    }
+    return nullptr;
+}
+
+const coral::net_msg_view_t::field_t& coral::net_msg_view_t::get_field(extlib::string_view key) const
+{
+    const field_t* field = find(key);
+    if (field == nullptr) {
+        throw coral::domain_error("There is no " + std::string(key.data(), key.size()) + " in the message.");
+    }
+    return *field;
+}
+
+void coral::net_msg_view_t::check_type(const field_t& field, NET_MSG_TYPE type)
+{
+    if (field.type != type) {
+        throw coral::domain_error("type mismatch of " + std::string(field.key.data(), field.key.size()) + " in the message.");
+    }
+}
+
+void coral::net_msg_view_t::get_scalar(const field_t& field, NET_MSG_TYPE type, void* value)
+{
+    check_type(field, type);
+    std::memcpy(value, field.value.data(), field.value.size());
+    switch (type) {
+        case NET_MSG_TYPE_INT:       *static_cast<int*>(value) = ntohl(*static_cast<int*>(value));                                     break;
+        case NET_MSG_TYPE_LONG:      *static_cast<long*>(value) = ntohl(*static_cast<long*>(value));                                   break;
+        case NET_MSG_TYPE_LONGLONG:  *static_cast<long long*>(value) = be64toh(*static_cast<long long*>(value));                       break;
+        case NET_MSG_TYPE_UINT:      *static_cast<unsigned int*>(value) = ntohl(*static_cast<unsigned int*>(value));                   break;
+        case NET_MSG_TYPE_ULONG:     *static_cast<unsigned long*>(value) = ntohl(*static_cast<unsigned long*>(value));                 break;
+        case NET_MSG_TYPE_ULONGLONG: *static_cast<unsigned long long*>(value) = be64toh(*static_cast<unsigned long long*>(value));     break;
+        default: break;
+    }
+}
+
+extlib::string_view coral::net_msg_view_t::get_string(extlib::string_view key) const
+{
+    const field_t& field = get_field(key);
+    check_type(field, NET_MSG_TYPE_STRING);
+    return field.value;
+}
+
+extlib::string_view coral::net_msg_view_t::get_bytes(extlib::string_view key) const
+{
+    const field_t& field = get_field(key);
+    check_type(field, NET_MSG_TYPE_BYTES);
+    return field.value;
+}
+
+namespace {
+    //! copy the elements of an array field in host byte order
+    template <typename T>
+    void copy_array(extlib::string_view value, std::vector<T>& values) {
+        values.resize(value.size() / sizeof(T));
+        if (!values.empty()) {
+            std::memcpy(values.data(), value.data(), values.size() * sizeof(T));
+        }
+        if (is_swapped_element<T>::value) {
+            for (auto& e : values) e = net_order(e);
+        }
+    }
+}
+
+void coral::net_msg_view_t::get_value(const field_t& field, std::string& value)
+{
+    check_type(field, NET_MSG_TYPE_STRING);
+    value.assign(field.value.data(), field.value.size());
+}
+
+void coral::net_msg_view_t::get_value(const field_t& field, std::vector<double>& values)
 {
-    int nCumSize = ::write(fd, &NET_MSG_TYPE_CODE[NET_MSG_TYPE_STRING], 1);
-    int size = htonl(str.size());
-    nCumSize += ::write(fd, &size, sizeof(int));
-    nCumSize += ::write(fd, str.c_str(), str.size());
-    return nCumSize;
+    check_type(field, NET_MSG_TYPE_DOUBLE_ARRAY);
+    copy_array(field.value, values);
 }
 
-int coral::net_msg_t::read_string_from_network(int fd, std::string& str)
+void coral::net_msg_view_t::get_value(const field_t& field, std::vector<int32_t>& values)
 {
-    str.clear();
-    int size = 0;
-    int nCumSize = ::read(fd, &size, sizeof(int));
-    size = ntohl(size);
-    str.resize(size);
-    nCumSize += ::read(fd, &str[0], size);
-    return nCumSize;
+    check_type(field, NET_MSG_TYPE_INT32_ARRAY);
+    copy_array(field.value, values);
+}
+
+void coral::net_msg_view_t::get_value(const field_t& field, std::vector<int64_t>& values)
+{
+    check_type(field, NET_MSG_TYPE_INT64_ARRAY);
+    copy_array(field.value, values);
+}
+
+void coral::net_msg_view_t::get_value(const field_t& field, std::vector<char>& values)
+{
+    check_type(field, NET_MSG_TYPE_BYTES);
+    values.assign(field.value.begin(), field.value.end());
+}
+
+bool coral::net_msg_view_t::parse(const char* data, size_t size, size_t& used, net_key_dictionary_t* keys)
+{
+    fields_.clear();
+    const char* pos = data;
+    const char* end = data + size;
+    // read a length prefixed string or array at pos, skip a type code ahead of it if code_size is 1
+    auto parse_string = [&pos, end](extlib::string_view& str, size_t code_size = 1, size_t element_size = 1) {
+        int len = 0;
+        if (end - pos < static_cast<long>(code_size + sizeof(int))) return false;
+        std::memcpy(&len, pos + code_size, sizeof(int));
+        len = ntohl(len);
+        if (len < 0) {
+            throw coral::domain_error("wrong length in the message.");
+        }
+        pos += code_size + sizeof(int);
+        size_t size = len * element_size;
+        // the receive buffer would grow to the length
+        if (size > coral::net_max_msg_size()) {
+            throw coral::domain_error("length over the maximum message size.");
+        }
+        if (static_cast<size_t>(end - pos) < size) return false;
+        str = extlib::string_view(pos, size);
+        pos += size;
+        return true;
+    };
+    // read a literal key or a key of the key dictionary at pos
+    auto parse_key = [&pos, end, keys, &parse_string](extlib::string_view& key) {
+        if (pos == end) return false;
+        if (*pos != NET_MSG_KEY_DEFINE_CODE && *pos != NET_MSG_KEY_ID_CODE) {
+            return parse_string(key);
+        }
+        if (keys == nullptr) {
+            throw coral::domain_error("a key id without the key dictionary.");
+        }
+        uint16_t id = 0;
+        if (end - pos < static_cast<long>(1 + sizeof(uint16_t))) return false;
+        bool is_define = *pos == NET_MSG_KEY_DEFINE_CODE;
+        std::memcpy(&id, pos + 1, sizeof(uint16_t));
+        id = ntohs(id);
+        pos += 1 + sizeof(uint16_t);
+        if (is_define) {
+            extlib::string_view str;
+            if (!parse_string(str, 0)) return false;
+            if (!keys->define(id, std::string(str.data(), str.size()))) {
+                throw coral::domain_error("wrong key id definition.");
+            }
+        }
+        // refer to the key in the dictionary, the buffer can be consumed before the view is used
+        const std::string* key_found = keys->find(id);
+        if (key_found == nullptr) {
+            throw coral::domain_error("undefined key id.");
+        }
+        key = extlib::string_view(key_found->data(), key_found->size());
+        return true;
+    };
+
+    int header[2] = {0, 0};
+    if (size < sizeof(header)) return false;
+    std::memcpy(header, pos, sizeof(header));
+    pos += sizeof(header);
+    int field_size = ntohl(header[1]);
+    for (int i = 0; i < field_size; i++) {
+        field_t field;
+        if (!parse_key(field.key) || pos == end) {
+            return false;
+        }
+        int type = net_msg_type_index(*pos);
+        if (type < 0) {
+            throw coral::domain_error("unknown value type code of " + std::string(field.key.data(), field.key.size()) + " in the message.");
+        }
+        field.type = static_cast<NET_MSG_TYPE>(type);
+        size_t value_size = net_msg_type_size(field.type);
+        if (value_size == 0) {
+            if (!parse_string(field.value, 1, net_msg_element_size(field.type))) return false;
+        }
+        else {
+            if (static_cast<size_t>(end - pos) < 1 + value_size) return false;
+            field.value = extlib::string_view(pos + 1, value_size);
+            pos += 1 + value_size;
+        }
+        fields_.push_back(field);
+    }
+    cmd = ntohl(header[0]);
+    used = pos - data;
+    return true;
+}
+
+int coral::net_msg_view_t::read_from_network(int fd, net_buffer_t& buffer)
+{
+    // the previous message isn't referred any more
+    buffer.consume(used_);
+    used_ = 0;
+    size_t used = 0;
+    ssize_t n = read_whole_message(fd, buffer);
+    if (n <= 0) {
+        cmd = -1;
+        fields_.clear();
+        return n < 0 ? -1 : 0;
+    }
+    if (!parse(buffer.data(), buffer.size(), used)) {
+        throw coral::domain_error("malformed message.");
+    }
+    used_ = used;
+    return used;
+}
+
+const std::string coral::net_msg_view_t::to_string() const
+{
+    std::ostringstream oss;
+    oss << "CMD:" << cmd << ',' << "SIZE:" << size() << ',' << "DATA:";
+    for (const auto& field : fields_) {
+        oss << field.key << '=';
+        switch (field.type) {
+            case NET_MSG_TYPE_BOOL:      oss << get<bool>(field.key);               break;
+            case NET_MSG_TYPE_CHAR:      oss << get<char>(field.key);               break;
+            case NET_MSG_TYPE_INT:       oss << get<int>(field.key);                break;
+            case NET_MSG_TYPE_LONG:      oss << get<long>(field.key);               break;
+            case NET_MSG_TYPE_LONGLONG:  oss << get<long long>(field.key);          break;
+            case NET_MSG_TYPE_UCHAR:     oss << get<unsigned char>(field.key);      break;
+            case NET_MSG_TYPE_UINT:      oss << get<unsigned int>(field.key);       break;
+            case NET_MSG_TYPE_ULONG:     oss << get<unsigned long>(field.key);      break;
+            case NET_MSG_TYPE_ULONGLONG: oss << get<unsigned long long>(field.key); break;
+            case NET_MSG_TYPE_FLOAT:     oss << get<float>(field.key);              break;
+            case NET_MSG_TYPE_DOUBLE:    oss << get<double>(field.key);             break;
+            case NET_MSG_TYPE_STRING:    oss << field.value;                        break;
+            case NET_MSG_TYPE_DOUBLE_ARRAY: { std::vector<double> values;  get_array(field.key, values); print_array(oss, values); break; }
+            case NET_MSG_TYPE_INT32_ARRAY:  { std::vector<int32_t> values; get_array(field.key, values); print_array(oss, values); break; }
+            case NET_MSG_TYPE_INT64_ARRAY:  { std::vector<int64_t> values; get_array(field.key, values); print_array(oss, values); break; }
+            case NET_MSG_TYPE_BYTES:        oss << '[' << field.value.size() << " bytes]";                                          break;
+        }
+        oss << ',';
+    }
+    return oss.str();
 }
 
 int coral::db_data_set_t::col_name_pos(const std::string& col_name) const
@@ -17,14 +17,19 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 
 #include <cmath>
+#include <cstdint>
 #include <complex>
+#include <type_traits>
 #include <vector>
 #include <set>
 #include <map>
+#include <memory>
+#include <deque>
 #include <unordered_set>
 #include <unordered_map>
 
@@ -35,10 +40,12 @@
     #include "boost/filesystem.hpp"
     #include "boost/any.hpp"
     #include "boost/regex.hpp"
+    #include "boost/utility/string_view.hpp"
 #else
     #include <filesystem>
     #include <any>
     #include <regex>
+    #include <string_view>
 #endif
 
 //! Core Library for Applications and Libraries
@@ -177,6 +184,10 @@ namespace coral {
           , NET_MSG_TYPE_FLOAT
           , NET_MSG_TYPE_DOUBLE
           , NET_MSG_TYPE_STRING
+          , NET_MSG_TYPE_DOUBLE_ARRAY
+          , NET_MSG_TYPE_INT32_ARRAY
+          , NET_MSG_TYPE_INT64_ARRAY
+          , NET_MSG_TYPE_BYTES
     };
     //! Network Message Type Code
     constexpr char NET_MSG_TYPE_CODE[] = {
@@ -192,7 +203,133 @@ namespace coral {
         , 'f'   // float
         , 'd'   // double
         , 's'   // char*, char const *, string, string const &
+        , 'D'   // vector<double>, count(4) and host order doubles like 'd'
+        , 'I'   // vector<int32_t>, count(4) and big-endian int32s
+        , 'X'   // vector<int64_t>, count(4) and big-endian int64s
+        , 'B'   // vector<char>, size(4) and raw bytes
         };
+    //! key code, a key with its dictionary id: 'K' id(2) length(4) key
+    constexpr char NET_MSG_KEY_DEFINE_CODE = 'K';
+    //! key code, a dictionary id of a key defined before: 'k' id(2)
+    constexpr char NET_MSG_KEY_ID_CODE = 'k';
+    /*! write all bytes to a file, it retries on a partial write and EINTR
+        a socket is written without SIGPIPE, a closed peer is an error(EPIPE)
+        \param fd a descriptor of a file
+        \param data bytes to be written
+        \param size the number of bytes
+        \return written size, -1 if an error occurred
+    */
+    ssize_t net_write_all(int fd, const void* data, size_t size);
+    /*! read bytes from a file until size bytes are read, it retries on a short read and EINTR
+        \param fd a descriptor of a file
+        \param data memory to be read into
+        \param size the number of bytes
+        \return read size, less than size on EOF, -1 if an error occurred
+    */
+    ssize_t net_read_all(int fd, void* data, size_t size);
+    //! the maximum bytes of a received message when NET_MAX_MSG_SIZE isn't set
+    constexpr size_t NET_DEFAULT_MAX_MSG_SIZE = 0x10000000;    // 256MB
+    /*! the maximum bytes of a received message or frame, NET_MAX_MSG_SIZE of the config
+        a length read from the wire over it is refused before anything is allocated for it
+        \return the limit, it is loaded from the config at the first call
+    */
+    size_t net_max_msg_size();
+    //! set the maximum bytes of a received message or frame
+    void net_max_msg_size(size_t size);
+    //! prefix of a unix domain socket endpoint, "unix:/path" or "unix:@name" in the abstract namespace
+    constexpr const char* NET_UNIX_ENDPOINT_PREFIX = "unix:";
+    /*! the path of a unix domain socket endpoint
+        \param endpoint "unix:/path" or an IP address
+        \return the path, empty if endpoint isn't a unix domain socket
+    */
+    std::string net_unix_path(const std::string& endpoint);
+    /*! fill the address of a unix domain socket
+        \param path path from net_unix_path(), a leading '@' is the abstract namespace
+        \param address address to be filled
+        \return the size of the address, 0 if the path is too long
+    */
+    socklen_t net_unix_address(const std::string& path, struct sockaddr_un& address);
+
+    //! byte buffer for network messages, it is reused by every message of a connection
+    class net_buffer_t {
+    public:
+        //! readable bytes
+        const char* data() const { return buffer_.data() + read_pos_; }
+        //! readable bytes, they can be modified
+        char* data() { return buffer_.data() + read_pos_; }
+        //! the number of readable bytes
+        size_t size() const { return write_pos_ - read_pos_; }
+        //! is there no readable bytes?
+        bool empty() const { return read_pos_ == write_pos_; }
+        //! drop all bytes but keep the allocated memory
+        void clear() { read_pos_ = write_pos_ = 0; }
+        /*! append bytes at the end
+            \param data bytes
+            \param size the number of bytes
+        */
+        void append(const void* data, size_t size) { std::memcpy(prepare(size), data, size); commit(size); }
+        /*! get writable space at the end, commit() has to be called after writing
+            \param size the number of bytes to be reserved
+            \return pointer of the writable space
+        */
+        char* prepare(size_t size);
+        /*! make bytes written into prepare() space readable
+            \param size the number of written bytes
+        */
+        void commit(size_t size) { write_pos_ += size; }
+        /*! drop bytes from the front
+            \param size the number of bytes
+        */
+        void consume(size_t size) {
+            read_pos_ += size;
+            if (read_pos_ >= write_pos_) clear();
+        }
+        /*! drop bytes from the end
+            \param size the number of readable bytes to be kept
+        */
+        void truncate(size_t size) { if (size < this->size()) write_pos_ = read_pos_ + size; }
+
+    private:
+        std::vector<char> buffer_;  ///< memory
+        size_t read_pos_ = 0;       ///< position of the first readable byte
+        size_t write_pos_ = 0;      ///< position of the end of readable bytes
+    }; // class net_buffer_t
+
+    //! key dictionary of a connection
+    /*!
+        a key is sent with an id once and only the id is sent after that.
+        a connection has one dictionary for sending and one for receiving.
+    */
+    class net_key_dictionary_t {
+    public:
+        //! the maximum number of keys, a key is sent as a string after the dictionary is full
+        static constexpr size_t max_size = 4096;
+        //! the number of keys
+        size_t size() const { return keys_.size(); }
+        //! clear all keys
+        void clear() { ids_.clear(); keys_.clear(); }
+        /*! sender side, get the id of a key and add the key if it isn't there
+            \param key
+            \param is_new true if the key has been added
+            \return id, -1 if the dictionary is full
+        */
+        int find_or_add(const std::string& key, bool& is_new);
+        //! sender side, remove keys added after the dictionary had size keys
+        void truncate(size_t size);
+        /*! receiver side, define a key with the id
+            \return false if the id is not the next id
+        */
+        bool define(uint16_t id, const std::string& key);
+        /*! receiver side, get a key by the id
+            \return nullptr if the id isn't defined
+        */
+        const std::string* find(uint16_t id) const { return id < keys_.size() ? &keys_[id] : nullptr; }
+
+    private:
+        std::unordered_map<std::string, uint16_t> ids_;   ///< sender side, key to id
+        std::deque<std::string> keys_;                      ///< keys by id, a deque keeps the keys in place
+    }; // class net_key_dictionary_t
+
     // message type for communication on network using TCP/IP
     class net_msg_t {
     public:
@@ -228,11 +365,39 @@ namespace coral {
             \return to be witten data size
         */
         int write_to_network(int fd);
-        /*! read a net_msg_t value from a file
+        /*! write a net_msg_t value to a file using one write call
             \param fd a descriptor of a file
-            \return to be read data size
+            \param buffer encoding buffer of the connection, it is reused for the next message
+            \return to be witten data size, -1 if an error occurred
+        */
+        int write_to_network(int fd, net_buffer_t& buffer);
+        /*! serialize a net_msg_t value at the end of the buffer
+            \param buffer encoding buffer
+            \param keys key dictionary for sending, nullptr if the keys are sent as strings
+        */
+        void encode(net_buffer_t& buffer, net_key_dictionary_t* keys = nullptr) const;
+        /*! read a net_msg_t value from a file, cmd is -1 on EOF or an error
+            \param fd a descriptor of a file
+            \return to be read data size, 0 on EOF, -1 if an error occurred
         */
         int read_from_network(int fd);
+        /*! read a net_msg_t value using the receive buffer of the connection.
+            it reads as many bytes as the file has and decodes a message out of the buffer,
+            the remaining bytes are kept in the buffer for the next message.
+            cmd is -1 on EOF or an error
+            \param fd a descriptor of a file
+            \param buffer receive buffer of the connection
+            \return decoded data size, 0 on EOF, -1 if an error occurred
+        */
+        int read_from_network(int fd, net_buffer_t& buffer);
+        /*! deserialize a net_msg_t value from bytes
+            \param data received bytes
+            \param size the number of received bytes
+            \param used the number of bytes of the message
+            \param keys key dictionary for receiving, nullptr if the keys are sent as strings
+            \return false if the bytes don't have a whole message yet
+        */
+        bool decode(const char* data, size_t size, size_t& used, net_key_dictionary_t* keys = nullptr);
         //! clear
         void clear();
         //! clear data container
@@ -241,21 +406,305 @@ namespace coral {
         const std::string to_string() const;
 
     private:
-        /*! std::string to binary
-            \param fd
-            \param str
-        */
-        int write_string_to_network(int fd, const std::string& str);
-        /*! binary to std::string
-            \param fd
-            \param str
-        */
-        int read_string_from_network(int fd, std::string& str);
         // key type is a string only
         // value type is a any but any type can be used string('s'), double('d'), int('i') only
         data_container_t data_container_;
     }; // class net_msg_t
 
+    //! command code of the protocol negotiation message, it is sent before any other message
+    constexpr int NET_MSG_CMD_HELLO = -2;
+    //! protocol version of the framed message
+    constexpr unsigned char NET_FRAME_VERSION = 1;
+    //! protocol features negotiated between a client and a server, bit flags
+    enum NET_PROTOCOL_FEATURE {
+          NET_PROTOCOL_FEATURE_NONE  = 0x00
+        , NET_PROTOCOL_FEATURE_FRAME = 0x01   ///< length prefixed frame
+        , NET_PROTOCOL_FEATURE_KEY_DICTIONARY = 0x02  ///< key dictionary, it needs NET_PROTOCOL_FEATURE_FRAME
+        , NET_PROTOCOL_FEATURE_COMPRESSION = 0x04     ///< zlib compressed frame body, it needs NET_PROTOCOL_FEATURE_FRAME
+        , NET_PROTOCOL_FEATURE_BATCH = 0x08           ///< one-way messages in a frame, it needs NET_PROTOCOL_FEATURE_FRAME
+    };
+    //! frame flags, bit flags
+    enum NET_FRAME_FLAG {
+          NET_FRAME_FLAG_NONE = 0x00
+        , NET_FRAME_FLAG_COMPRESSED = 0x01  ///< body is original size(4) and zlib data
+        , NET_FRAME_FLAG_BATCH = 0x02       ///< body is encoded messages one after another, they aren't replied
+    };
+    //! header of a framed message, the message follows the header
+    /*!
+        length(4) version(1) flags(1) reserved(2) request_id(4), numbers are in network byte order
+    */
+    struct net_frame_header_t {
+        static constexpr size_t size = 12;  ///< wire size of the header
+
+        uint32_t length = 0;            ///< total bytes of the frame including the header
+        unsigned char version = NET_FRAME_VERSION;  ///< protocol version
+        unsigned char flags = 0;        ///< NET_FRAME_FLAG
+        uint32_t request_id = 0;        ///< request id, a reply has the id of its request
+
+        /*! write the header
+            \param data size bytes of memory
+        */
+        void encode(char* data) const;
+        /*! read the header
+            \param data received bytes
+            \param size the number of received bytes
+            \return false if the bytes don't have a whole header yet
+            \exception domain_error the length is wrong or over net_max_msg_size()
+        */
+        bool decode(const char* data, size_t size);
+    };
+
+    //! NET_MSG_TYPE of a C++ type
+    template <typename T> struct net_value_type;
+    template <> struct net_value_type<bool>               { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_BOOL;      };
+    template <> struct net_value_type<char>               { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_CHAR;      };
+    template <> struct net_value_type<int>                { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_INT;       };
+    template <> struct net_value_type<long>               { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_LONG;      };
+    template <> struct net_value_type<long long>          { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_LONGLONG;  };
+    template <> struct net_value_type<unsigned char>      { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_UCHAR;     };
+    template <> struct net_value_type<unsigned int>       { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_UINT;      };
+    template <> struct net_value_type<unsigned long>      { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_ULONG;     };
+    template <> struct net_value_type<unsigned long long> { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_ULONGLONG; };
+    template <> struct net_value_type<float>              { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_FLOAT;     };
+    template <> struct net_value_type<double>             { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_DOUBLE;    };
+    template <> struct net_value_type<std::string>        { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_STRING;    };
+    template <> struct net_value_type<std::vector<double>>  { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_DOUBLE_ARRAY; };
+    template <> struct net_value_type<std::vector<int32_t>> { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_INT32_ARRAY;  };
+    template <> struct net_value_type<std::vector<int64_t>> { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_INT64_ARRAY;  };
+    template <> struct net_value_type<std::vector<char>>    { static constexpr NET_MSG_TYPE value = NET_MSG_TYPE_BYTES;        };
+
+    /*! append the header of a message in the wire format
+        \param buffer buffer
+        \param cmd command code
+        \param size the number of fields
+    */
+    void net_encode_header(net_buffer_t& buffer, int cmd, int size);
+    /*! append a field in the wire format, net_schema.h writes message structs with it
+        \param buffer buffer
+        \param key key
+        \param value value, a type which has net_value_type
+        \param keys key dictionary for sending, nullptr if the keys are sent as strings
+    */
+    template <typename T>
+    void net_encode_field(net_buffer_t& buffer, extlib::string_view key, const T& value, net_key_dictionary_t* keys = nullptr);
+
+    //! value of a network message field
+    /*!
+        a closed set of the NET_MSG_TYPE types, scalar values are stored inline
+        and the type is dispatched by NET_MSG_TYPE index instead of typeid comparison.
+        an array is immutable and shared between the copies of the value.
+    */
+    class net_value_t {
+    public:
+        //! default constructor, int 0
+        net_value_t() : type_(NET_MSG_TYPE_INT) { scalar_.i = 0; }
+        //! scalar value constructor
+        template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+        net_value_t(T value) : type_(net_value_type<T>::value) { *reinterpret_cast<T*>(&scalar_) = value; }
+        //! string value constructor
+        net_value_t(const char* value) : type_(NET_MSG_TYPE_STRING), str_(value) {}
+        //! string value constructor
+        net_value_t(std::string value) : type_(NET_MSG_TYPE_STRING), str_(std::move(value)) {}
+        //! array value constructor, vector<double>, vector<int32_t>, vector<int64_t> or vector<char>
+        template <typename T>
+        net_value_t(std::vector<T> value)
+            : type_(net_value_type<std::vector<T>>::value), array_(std::make_shared<const std::vector<T>>(std::move(value))) {}
+
+        //! type index of the value
+        NET_MSG_TYPE type() const { return type_; }
+        /*! get the value
+            \return value, if T is not the type of the value then throw domain_error
+        */
+        template <typename T>
+        const T& get() const {
+            check_type(net_value_type<T>::value);
+            return *reinterpret_cast<const T*>(&scalar_);
+        }
+        //! value to string
+        std::string to_string() const;
+
+    private:
+        //! throw domain_error if type is not the type of the value
+        void check_type(NET_MSG_TYPE type) const;
+        //! get the array value
+        template <typename T>
+        const T& get_array() const {
+            check_type(net_value_type<T>::value);
+            return *static_cast<const T*>(array_.get());
+        }
+
+        NET_MSG_TYPE type_;     ///< type index
+        union {
+            bool b; char c; int i; long l; long long x;
+            unsigned char h; unsigned int j; unsigned long m; unsigned long long y;
+            float f; double d;
+        } scalar_;              ///< scalar value
+        std::string str_;       ///< string value
+        std::shared_ptr<const void> array_; ///< array value, std::vector of the element type
+    }; // class net_value_t
+
+    template <>
+    inline const std::string& net_value_t::get<std::string>() const {
+        check_type(NET_MSG_TYPE_STRING);
+        return str_;
+    }
+    template <>
+    inline const std::vector<double>& net_value_t::get<std::vector<double>>() const { return get_array<std::vector<double>>(); }
+    template <>
+    inline const std::vector<int32_t>& net_value_t::get<std::vector<int32_t>>() const { return get_array<std::vector<int32_t>>(); }
+    template <>
+    inline const std::vector<int64_t>& net_value_t::get<std::vector<int64_t>>() const { return get_array<std::vector<int64_t>>(); }
+    template <>
+    inline const std::vector<char>& net_value_t::get<std::vector<char>>() const { return get_array<std::vector<char>>(); }
+
+    //! read-only view of a received message
+    /*!
+        it parses a message in place, keys and values point into the receive buffer,
+        so nothing is allocated per message. a view is valid until the next read
+        of the receive buffer.
+    */
+    class net_msg_view_t {
+    public:
+        //! a field of the message
+        struct field_t {
+            extlib::string_view key;    ///< key
+            NET_MSG_TYPE type;          ///< value type
+            extlib::string_view value;  ///< value bytes in network format, the string itself for a string value, the elements for an array
+        };
+
+        int cmd = -1;    ///< command code
+        //! the number of fields
+        size_t size() const { return fields_.size(); }
+        //! fields in the order of the message
+        const std::vector<field_t>& fields() const { return fields_; }
+        /*! find a field by key
+            \param key
+            \return nullptr if there is no key
+        */
+        const field_t* find(extlib::string_view key) const;
+        //! is there the key?
+        bool has(extlib::string_view key) const { return find(key) != nullptr; }
+        /*! get a scalar value in host byte order
+            \param key
+            \return value, if there is no key or T is not the type of the value then throw domain_error
+        */
+        template <typename T>
+        T get(extlib::string_view key) const {
+            T value;
+            get_value(get_field(key), value);
+            return value;
+        }
+        /*! get a string value
+            \param key
+            \return view of the string, if there is no key or the value isn't a string then throw domain_error
+        */
+        extlib::string_view get_string(extlib::string_view key) const;
+        /*! get a byte array value
+            \param key
+            \return view of the bytes, if there is no key or the value isn't a byte array then throw domain_error
+        */
+        extlib::string_view get_bytes(extlib::string_view key) const;
+        /*! copy an array value in host byte order
+            \param key
+            \param values array, if there is no key or the value isn't the array type then throw domain_error
+        */
+        void get_array(extlib::string_view key, std::vector<double>& values) const { get_value(get_field(key), values); }
+        //! copy an array value in host byte order
+        void get_array(extlib::string_view key, std::vector<int32_t>& values) const { get_value(get_field(key), values); }
+        //! copy an array value in host byte order
+        void get_array(extlib::string_view key, std::vector<int64_t>& values) const { get_value(get_field(key), values); }
+        /*! copy the value of a field in host byte order
+            \param field a field of the message
+            \param value value, if T is not the type of the field then throw domain_error
+        */
+        template <typename T>
+        static void get_value(const field_t& field, T& value) { get_scalar(field, net_value_type<T>::value, &value); }
+        //! copy a string value of a field
+        static void get_value(const field_t& field, std::string& value);
+        //! copy an array value of a field in host byte order
+        static void get_value(const field_t& field, std::vector<double>& values);
+        //! copy an array value of a field in host byte order
+        static void get_value(const field_t& field, std::vector<int32_t>& values);
+        //! copy an array value of a field in host byte order
+        static void get_value(const field_t& field, std::vector<int64_t>& values);
+        //! copy a byte array value of a field
+        static void get_value(const field_t& field, std::vector<char>& values);
+        /*! parse a message in place
+            \param data received bytes
+            \param size the number of received bytes
+            \param used the number of bytes of the message
+            \param keys key dictionary for receiving, nullptr if the keys are sent as strings
+            \return false if the bytes don't have a whole message yet
+        */
+        bool parse(const char* data, size_t size, size_t& used, net_key_dictionary_t* keys = nullptr);
+        /*! read a message using the receive buffer of the connection and parse it in place.
+            the bytes of the previous message are dropped from the buffer at this time.
+            cmd is -1 on EOF or an error
+            \param fd a descriptor of a file
+            \param buffer receive buffer of the connection
+            \return message size, 0 on EOF, -1 if an error occurred
+        */
+        int read_from_network(int fd, net_buffer_t& buffer);
+        //! to string
+        const std::string to_string() const;
+
+    private:
+        //! get a scalar value of a field into value
+        static void get_scalar(const field_t& field, NET_MSG_TYPE type, void* value);
+        //! throw domain_error if the type is not the type of the field
+        static void check_type(const field_t& field, NET_MSG_TYPE type);
+        //! get the field by key, throw domain_error if there is no key
+        const field_t& get_field(extlib::string_view key) const;
+
+        std::vector<field_t> fields_;   ///< parsed fields, the capacity is reused
+        size_t used_ = 0;               ///< bytes of the current message in the receive buffer
+    }; // class net_msg_view_t
+
+    //! message type for communication on network using net_value_t values
+    /*!
+        it has the same interface and the same wire format as net_msg_t,
+        so a server and its clients can move to net_variant_msg_t one by one.
+    */
+    class net_variant_msg_t {
+    public:
+        using key_type = std::string;
+        using value_type = net_value_t;
+        using data_container_t = std::unordered_map<key_type, value_type>;
+
+        int cmd = -1;    ///< command code
+        int size() const { return data_container_.size(); }  ///< size of data_container_
+
+        //! get data_container_
+        const data_container_t& data_container() const { return data_container_; }
+        //! copy data_container to data_container_
+        void data_container(const data_container_t& data_container) { data_container_ = data_container; }
+        //! insert an element(key and value) at data_container_
+        void data_container(const key_type& key, const value_type& value) { data_container_[key] = value; }
+        //! get value by key from data_container_, throw domain_error if there is no key
+        const value_type& data_container(const key_type& key) const;
+        //! write to a file, see net_msg_t::write_to_network()
+        int write_to_network(int fd);
+        //! write to a file, see net_msg_t::write_to_network()
+        int write_to_network(int fd, net_buffer_t& buffer);
+        //! serialize at the end of the buffer, see net_msg_t::encode()
+        void encode(net_buffer_t& buffer, net_key_dictionary_t* keys = nullptr) const;
+        //! read from a file, see net_msg_t::read_from_network()
+        int read_from_network(int fd);
+        //! read from a file, see net_msg_t::read_from_network()
+        int read_from_network(int fd, net_buffer_t& buffer);
+        //! deserialize from bytes, see net_msg_t::decode()
+        bool decode(const char* data, size_t size, size_t& used, net_key_dictionary_t* keys = nullptr);
+        //! clear
+        void clear() { cmd = 0; data_container_.clear(); }
+        //! clear data container
+        void clear_data_container() { data_container_.clear(); }
+        //! to string
+        const std::string to_string() const;
+
+    private:
+        data_container_t data_container_;
+    }; // class net_variant_msg_t
+
     //! Database data type
     /*!
         col_list\n
@@ -801,6 +1250,12 @@ namespace coral {
     \return output stream
 */
 std::ostream& operator<<(std::ostream& os, coral::net_msg_t& msg);
+/*! overloading operator<< for net_variant_msg_t
+    \param os output stream
+    \param msg message
+    \return output stream
+*/
+std::ostream& operator<<(std::ostream& os, const coral::net_variant_msg_t& msg);
 
 /*! overloading operator>> for point
     \param is input stream
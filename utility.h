@@ -378,6 +378,10 @@ namespace coral {
         \return a time_t value
     */
     time_t string_to_time(const std::string& str, TIME_STRING_FORMAT timeformat = TIME_STRING_FORMAT::NUMBERDATE3);
+    //! monotonic milliseconds for the timeouts, it doesn't move with the wall clock
+    inline uint64_t steady_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
     //-------------------------------------------------------------------------------------------------------------
     //! Randomly selection an element from a container using random generator